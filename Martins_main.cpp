@@ -327,8 +327,6 @@ int main()
             glColor3f(0, 0, 1);
             glVertex2f(-0.5f, 0.5f);
             glEnd();
-
-            glBindFramebuffer(GL_FRAMEBUFFER, fbuf);
         }
 
         wglDXUnlockObjectsNV(dxDevice, _countof(dxObjects), dxObjects);
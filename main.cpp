@@ -1,25 +1,286 @@
-#include <dxgi1_3.h>
-#include <d3d11.h>
+#include <dxgi1_5.h>
+#include <d3d11_1.h>
+#include <d3dcompiler.h>
 #include <comdef.h>
+#include <crtdbg.h>
 
 #include "glcorearb.h"
 #include "wglext.h"
 
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
 
 #pragma comment(lib, "dxgi.lib")
 #pragma comment(lib, "d3d11.lib")
+#pragma comment(lib, "d3dcompiler.lib")
 #pragma comment(lib, "opengl32.lib")
 
 #define SCREEN_WIDTH 640
 #define SCREEN_HEIGHT 480
 
-// Define this to use a Windows 10 FLIP_DISCARD swap chain
-// FLIP_DISCARD produces incorrect results on NVIDIA (see README),
-// so you probably don't want to use this in practice yet.
-// If this isn't defined, then a simple DISCARD swap chain is used.
-// #define USE_WIN10_SWAPCHAIN
+// Number of frames each interop strategy is rendered for when probing it.
+// This is enough to cycle through every buffer of the swap chain.
+#define PROBE_FRAMES (DXGI_MAX_SWAP_CHAIN_BUFFERS + 4)
+// Number of frames rendered after those, without checking them, to time the strategy.
+// The checks read back from the GPU, so timing the checked frames would mostly measure those stalls.
+#define PROBE_TIMED_FRAMES 16
+
+// Define this to present with IDXGISwapChain1::Present1, passing the rectangles the D3D and GL passes touched.
+// That only works with FLIP_SEQUENTIAL swap chains, and lets the compositor update just those parts of the window.
+// The clears are also limited to what changed since the acquired buffer was last rendered, unless its contents were discarded.
+// Scroll rectangles aren't passed, since nothing in the demo scrolls.
+// #define USE_DIRTY_RECTS
+
+// Most rectangles tracked per frame before nearby ones get merged
+#define MAX_DIRTY_RECTS 8
+
+// Define this to check the damage tracking's rectangle math at startup. It fails the same way a failed HRESULT does.
+// #define DAMAGE_TRACKER_TEST
+
+// How often an occluded or minimized window does a test present to find out whether it's visible again
+#define OCCLUDED_TEST_INTERVAL_MS 100
+
+// How frames are presented
+enum PresentMode
+{
+    // Wait for vblank
+    PRESENT_MODE_VSYNC,
+    // Present as soon as the frame is done, tearing on flip model swap chains where the display supports it (variable refresh rate)
+    PRESENT_MODE_IMMEDIATE,
+    // Like PRESENT_MODE_IMMEDIATE, but the CPU waits between frames to cap the frame rate at CAPPED_FRAMES_PER_SECOND
+    PRESENT_MODE_CAPPED,
+    // Wait for vblank, but delay the start of every frame so it's done just in time for the next vblank (see FramePacer)
+    PRESENT_MODE_PACED,
+};
+
+#define PRESENT_MODE PRESENT_MODE_IMMEDIATE
+#define CAPPED_FRAMES_PER_SECOND 144.0
+// Frames timed to predict how long the next one takes with PRESENT_MODE_PACED, and how much earlier than that it starts
+#define FRAME_PACER_HISTORY 32
+#define FRAME_PACER_MARGIN_MS 1.0
+
+// Format and color space of the swap chains and the color buffers both APIs render to (see g_colorFormats)
+enum ColorFormatIndex
+{
+    // 8 bits per channel sRGB, the only format every driver is known to share
+    COLOR_FORMAT_RGBA8,
+    // 10 bits per channel sRGB
+    COLOR_FORMAT_RGB10A2,
+    // 10 bits per channel HDR10 (ST.2084 curve, BT.2020 primaries)
+    COLOR_FORMAT_HDR10,
+    // 16 bit float per channel scRGB (linear, BT.709 primaries, 1.0 is 80 nits)
+    COLOR_FORMAT_SCRGB,
+};
+
+// Falls back to COLOR_FORMAT_RGBA8 if the format can't be shared. HDR color spaces also need a flip model strategy.
+#define COLOR_FORMAT COLOR_FORMAT_RGBA8
+
+// GL_KHR_parallel_shader_compile isn't in the bundled glcorearb.h. GL_ARB_parallel_shader_compile uses the same values.
+#ifndef GL_KHR_parallel_shader_compile
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) (GLuint count);
+#endif
+
+// Defined by the Windows 10 1803 SDK and later
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// File that caches startup decisions between runs (see StartupProfile)
+#define STARTUP_PROFILE_PATH "OpenGL_on_DXGI.profile"
+
+// Directory that caches GL program binaries between runs (see ProgramCacheGL)
+#define PROGRAM_CACHE_DIRECTORY "OpenGL_on_DXGI.programs"
+
+// Most programs that can be compiling at once
+#define MAX_PENDING_PROGRAMS 16
+
+// File of precompiled D3D shader bytecode, memory-mapped at startup (see ShaderLoaderD3D)
+#define SHADER_PACK_PATH "OpenGL_on_DXGI.shaders"
+
+// Most D3D shaders that can be requested from the shader loader
+#define MAX_SHADER_REQUESTS 64
+
+// File of textures with their mip chains, memory-mapped and created without copying (see TexturePack).
+// Each texture's data starts on a page boundary.
+#define TEXTURE_PACK_PATH "OpenGL_on_DXGI.textures"
+#define TEXTURE_PACK_ALIGNMENT 4096
+
+// Define this to build a pack of generated textures at startup, if it doesn't exist yet, and compare how fast
+// its textures are created from the mapped file vs. from a copy read into memory with fread.
+// #define TEXTURE_PACK_BENCHMARK
+#define TEXTURE_PACK_BENCHMARK_TEXTURES 8
+#define TEXTURE_PACK_BENCHMARK_SIZE 1024
+#define TEXTURE_PACK_BENCHMARK_ITERATIONS 5
+
+// Define this to create the backbuffer's RTV and GL registration once at startup and reuse them every frame,
+// instead of recreating them per frame. D3D11 always exposes the current backbuffer as buffer 0,
+// so steady-state frames then don't allocate anything, which is checked by the allocation counters below.
+// #define USE_PERSISTENT_FRAME_OBJECTS
+
+// Define this to render into multisampled color and depth buffers shared by D3D and GL, resolved once per frame into the swap chain.
+// Multisampled resources can only be registered as GL renderbuffers and can't be presented directly,
+// so only the copy/renderbuffer strategies are used, and their copy becomes a ResolveSubresource.
+// The count is lowered if the device doesn't support it for both the color and depth formats.
+// #define MSAA_SAMPLE_COUNT 4
+
+// Define this to draw overlapping quads from both APIs into the shared depth buffer, which only D3D clears.
+// The depth format is then negotiated at startup: the cheapest format the driver can share that also passes
+// a pixel-exact depth test across the D3D/GL handoff (see VerifySharedDepth). The result is cached in the startup profile.
+// #define SHARED_DEPTH_TEST
+
+// Define this to draw a benchmark scene on top of every frame: BENCHMARK_OBJECT_COUNT objects, each an instanced draw
+// of BENCHMARK_INSTANCES_PER_OBJECT quads. BENCHMARK_D3D_FRACTION of them are drawn by D3D and the rest by GL,
+// split into BENCHMARK_API_SWITCHES chunks per API so the frame hands the buffers from D3D to GL and back that many times.
+// Draw calls per second and the CPU cost of each handoff are reported with the other stats.
+// #define BENCHMARK_SCENE
+#define BENCHMARK_OBJECT_COUNT 4096
+#define BENCHMARK_INSTANCES_PER_OBJECT 16
+#define BENCHMARK_D3D_FRACTION 0.5
+#define BENCHMARK_API_SWITCHES 4
+
+// Define this to submit the benchmark's GL objects with glMultiDrawElementsIndirect (see BatchRendererGL),
+// so each GL chunk is a single call while the buffers are locked, instead of one draw per object.
+// Needs GL 4.4 or ARB_buffer_storage for the persistently mapped buffers, otherwise it falls back to one draw per object.
+// #define USE_GL_MULTI_DRAW_INDIRECT
+
+// Define this to record the benchmark's D3D draws on worker threads into deferred contexts.
+// Each worker records a slice of every D3D chunk into its own command lists while the main thread does the rest of the frame,
+// and the main thread executes them in worker order right before each handoff to GL.
+// There's one worker per hardware thread, up to MAX_RECORD_WORKERS.
+// #define USE_DEFERRED_CONTEXTS
+#define MAX_RECORD_WORKERS 16
+
+// Define this to run the frame's CPU stages (animating the benchmark objects and building the GL batch)
+// as a task graph on the work-stealing job system, instead of serially on the main thread.
+// At startup, the job system's scaling is also measured with 1 to N threads (see BenchmarkJobSystem).
+// #define USE_JOB_SYSTEM
+
+// Most threads the job system runs, including the main thread
+#define MAX_JOB_THREADS 32
+// Jobs each thread's deque can hold
+#define JOB_DEQUE_CAPACITY 4096
+// Jobs that can depend on a single job
+#define MAX_JOB_CONTINUATIONS 8
+// Bytes each thread can allocate per frame from its frame allocator
+#define FRAME_ALLOCATOR_SIZE (1 << 20)
+// Objects per job of the frame's CPU stages
+#define JOB_GRAIN_SIZE 256
+// Items and graphs run per thread count by the job system scaling benchmark
+#define JOB_BENCHMARK_ITEMS (1 << 18)
+#define JOB_BENCHMARK_GRAPHS 50
+
+// Define this to stream a CPU-generated texture into a texture shared with GL every frame, through a ring of staging textures
+// written by a background thread (see TextureStreamer). GL draws it in its half of the window.
+// Upload throughput and stalls are reported with the other stats.
+// #define TEXTURE_STREAMING
+#define STREAM_TEXTURE_SIZE 512
+#define STREAM_RING_SIZE 3
+
+// Define this to simulate particles with GL compute shaders in a D3D structured buffer, leaving a trail in a D3D UAV texture,
+// and draw both with D3D (see ParticleSystem). The compute resources are locked in the same call as the frame's render targets.
+// At startup, dispatch throughput is measured with one lock around all dispatches vs. a D3D handoff after each one.
+// #define COMPUTE_INTEROP
+#define PARTICLE_COUNT 65536
+#define PARTICLE_TRAIL_SIZE 256
+#define PARTICLE_TRAIL_FADE 0.95f
+#define PARTICLE_TIME_STEP (1.0f / 60.0f)
+#define MAX_COMPUTE_RESOURCES 8
+#define COMPUTE_BENCHMARK_DISPATCHES 1000
+
+// Number of frames in flight the frame arena is split into, and the bytes of each (see FrameArena)
+#define FRAME_ARENA_FRAMES 3
+#define FRAME_ARENA_SIZE (64 * 1024)
+// Define this to compare the frame arena with malloc at startup, with these frames and allocations per frame.
+// It runs inside the startup breakdown's outputs phase, so leave it off when timing startup.
+// #define FRAME_ARENA_BENCHMARK
+#define FRAME_ARENA_BENCHMARK_FRAMES 1000
+#define FRAME_ARENA_BENCHMARK_ALLOCATIONS 256
+
+// Number of frames the persistently mapped batch buffers are split into, so the CPU writes one while the GPU reads the others
+#define BATCH_BUFFERED_FRAMES 3
+
+// Number of resolves timed per sample count by the startup resolve benchmark
+#define RESOLVE_BENCHMARK_ITERATIONS 100
+
+// Number of presents per window whose issue time is remembered, until the frame statistics say they were displayed
+#define PRESENT_MONITOR_HISTORY 64
+
+// Input messages remembered until the vblank that displayed the frame consuming them is known,
+// and the 1 ms buckets their latency is counted in
+#define INPUT_EVENT_HISTORY 1024
+#define INPUT_LATENCY_BUCKETS 100
+#define INPUT_LATENCY_BUCKET_MS 1.0
+
+// Number of windows to present to. Each window gets its own swap chain,
+// but they all share one D3D11 device, one interop device handle and one GL context.
+#define NUM_OUTPUT_WINDOWS 1
+
+// Number of frames to run before allocations are expected to stop
+#define ALLOCATION_WARMUP_FRAMES 60
+
+// Number of frames between allocation and frame time reports
+#define STATS_REPORT_FRAMES 600
+
+// Number of distinct blend, rasterizer and depth-stencil states the state object cache can hold
+#define STATE_OBJECT_CACHE_SIZE 64
+
+// Counts heap allocations and COM/interop objects acquired by the frame loop.
+// Debug builds count every CRT heap allocation through an allocation hook. Release builds don't have the hook,
+// so there only operator new and MallocCounted are counted.
+struct AllocationCounters
+{
+    std::atomic<unsigned> heapAllocs;
+    std::atomic<unsigned> comAllocs;
+};
+
+static AllocationCounters g_allocCounters;
+
+#ifdef _DEBUG
+int __cdecl CountAllocHook(int allocType, void* userData, size_t size, int blockType, long requestNumber, const unsigned char* fileName, int lineNumber)
+{
+    if (allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC)
+    {
+        g_allocCounters.heapAllocs++;
+    }
+    return TRUE;
+}
+#endif
+
+void* MallocCounted(size_t size)
+{
+#ifndef _DEBUG
+    g_allocCounters.heapAllocs++;
+#endif
+    return malloc(size);
+}
+
+void* operator new(size_t size)
+{
+    void* p = MallocCounted(size ? size : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void CountComAlloc()
+{
+    g_allocCounters.comAllocs++;
+}
 
 void APIENTRY DebugCallbackGL(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *userParam)
 {
@@ -28,17 +289,297 @@ void APIENTRY DebugCallbackGL(GLenum source, GLenum type, GLuint id, GLenum seve
     OutputDebugStringA("\n");
 }
 
+// An input message, stamped when WndProc received it and followed through the frame that consumed it,
+// that frame's present, and the vblank the present was displayed at
+struct InputEvent
+{
+    LONGLONG arrivalTicks;
+    unsigned frame;
+    UINT presentCount;
+};
+
+// Input events are appended by WndProc and move through the stages in order, so each stage is a range of the ring:
+// [undisplayed, unpresented) are presented, [unpresented, untagged) are tagged with a frame, [untagged, head) are untagged.
+// The indices only ever grow, and are wrapped when indexing the ring.
+struct InputLatencyTracker
+{
+    InputEvent events[INPUT_EVENT_HISTORY];
+    unsigned head;
+    unsigned untagged;
+    unsigned unpresented;
+    unsigned undisplayed;
+
+    // Since the last report, in INPUT_LATENCY_BUCKET_MS buckets. The last bucket also counts everything slower.
+    unsigned presentHistogram[INPUT_LATENCY_BUCKETS];
+    unsigned displayHistogram[INPUT_LATENCY_BUCKETS];
+    unsigned presented;
+    unsigned displayed;
+    unsigned displayUnknown; // displayed along with later presents, so the frame statistics never dated their present
+    unsigned dropped; // overwritten before they were displayed
+    LONGLONG qpcFrequency;
+};
+
+static InputLatencyTracker g_inputLatency;
+
+bool IsInputMessage(UINT msg)
+{
+    return (msg >= WM_KEYFIRST && msg <= WM_KEYLAST) || (msg >= WM_MOUSEFIRST && msg <= WM_MOUSELAST) || msg == WM_INPUT;
+}
+
+void AddLatencySample(InputLatencyTracker* tracker, unsigned* histogram, LONGLONG ticks)
+{
+    // Clamped on both ends: a sample can come out negative when the vblank time predates the event's timestamp,
+    // and converting a huge one to int would overflow before it could be clamped
+    double bucketMs = 1000.0 * ticks / tracker->qpcFrequency / INPUT_LATENCY_BUCKET_MS;
+    int bucket = bucketMs < 0.0 ? 0 : bucketMs >= INPUT_LATENCY_BUCKETS ? INPUT_LATENCY_BUCKETS - 1 : (int)bucketMs;
+    histogram[bucket]++;
+}
+
+void StampInputEvent(InputLatencyTracker* tracker, LONGLONG arrivalTicks)
+{
+    // The oldest event gives way when the display falls this far behind, like when the statistics are unavailable
+    if (tracker->head - tracker->undisplayed == INPUT_EVENT_HISTORY)
+    {
+        tracker->undisplayed++;
+        tracker->unpresented = tracker->unpresented > tracker->undisplayed ? tracker->unpresented : tracker->undisplayed;
+        tracker->untagged = tracker->untagged > tracker->unpresented ? tracker->untagged : tracker->unpresented;
+        tracker->dropped++;
+    }
+
+    InputEvent& event = tracker->events[tracker->head % INPUT_EVENT_HISTORY];
+    event.arrivalTicks = arrivalTicks;
+    event.frame = 0;
+    event.presentCount = 0;
+    tracker->head++;
+}
+
+// Called once the frame handled its messages, so everything received so far is input that frame consumes
+void TagInputEvents(InputLatencyTracker* tracker, unsigned frame)
+{
+    for (; tracker->untagged != tracker->head; tracker->untagged++)
+    {
+        tracker->events[tracker->untagged % INPUT_EVENT_HISTORY].frame = frame;
+    }
+}
+
+// Called once the frame is presented. Events of frames that weren't presented, like when every output was occluded, go with this one.
+void PresentInputEvents(InputLatencyTracker* tracker, UINT presentCount, LONGLONG presentedTicks)
+{
+    for (; tracker->unpresented != tracker->untagged; tracker->unpresented++)
+    {
+        InputEvent& event = tracker->events[tracker->unpresented % INPUT_EVENT_HISTORY];
+        event.presentCount = presentCount;
+        AddLatencySample(tracker, tracker->presentHistogram, presentedTicks - event.arrivalTicks);
+        tracker->presented++;
+    }
+}
+
+// Called with the last present the frame statistics saw displayed, and the time of its vblank
+void DisplayInputEvents(InputLatencyTracker* tracker, UINT displayedPresentCount, LONGLONG displayedTicks)
+{
+    for (; tracker->undisplayed != tracker->unpresented; tracker->undisplayed++)
+    {
+        const InputEvent& event = tracker->events[tracker->undisplayed % INPUT_EVENT_HISTORY];
+        if ((int)(displayedPresentCount - event.presentCount) < 0)
+        {
+            break;
+        }
+
+        if (event.presentCount == displayedPresentCount)
+        {
+            AddLatencySample(tracker, tracker->displayHistogram, displayedTicks - event.arrivalTicks);
+            tracker->displayed++;
+        }
+        else
+        {
+            tracker->displayUnknown++;
+        }
+    }
+}
+
+// Upper end of the bucket the given fraction of the samples is in
+double LatencyPercentileMs(const unsigned* histogram, unsigned samples, double fraction)
+{
+    unsigned needed = (unsigned)ceil(samples * fraction);
+    unsigned seen = 0;
+    for (int i = 0; i < INPUT_LATENCY_BUCKETS; i++)
+    {
+        seen += histogram[i];
+        if (seen >= needed && seen > 0)
+        {
+            return (i + 1) * INPUT_LATENCY_BUCKET_MS;
+        }
+    }
+    return 0.0;
+}
+
+void ReportInputLatency(InputLatencyTracker* tracker)
+{
+    char buf[256];
+    sprintf_s(buf, "Input latency: %u to present (p50 %.0f ms, p90 %.0f ms, p99 %.0f ms), %u to display (p50 %.0f ms, p90 %.0f ms, p99 %.0f ms), %u display unknown, %u dropped\n",
+        tracker->presented,
+        LatencyPercentileMs(tracker->presentHistogram, tracker->presented, 0.5),
+        LatencyPercentileMs(tracker->presentHistogram, tracker->presented, 0.9),
+        LatencyPercentileMs(tracker->presentHistogram, tracker->presented, 0.99),
+        tracker->displayed,
+        LatencyPercentileMs(tracker->displayHistogram, tracker->displayed, 0.5),
+        LatencyPercentileMs(tracker->displayHistogram, tracker->displayed, 0.9),
+        LatencyPercentileMs(tracker->displayHistogram, tracker->displayed, 0.99),
+        tracker->displayUnknown,
+        tracker->dropped);
+    OutputDebugStringA(buf);
+
+    memset(tracker->presentHistogram, 0, sizeof(tracker->presentHistogram));
+    memset(tracker->displayHistogram, 0, sizeof(tracker->displayHistogram));
+    tracker->presented = 0;
+    tracker->displayed = 0;
+    tracker->displayUnknown = 0;
+    tracker->dropped = 0;
+}
+
 LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
+    if (IsInputMessage(msg))
+    {
+        LARGE_INTEGER arrival;
+        QueryPerformanceCounter(&arrival);
+        StampInputEvent(&g_inputLatency, arrival.QuadPart);
+    }
+
     switch (msg)
     {
     case WM_CLOSE:
-        ExitProcess(0);
+        // The frame loop exits once it sees the quit message, after saving what has to outlive the process
+        PostQuitMessage(0);
+        return 0;
     }
 
     return DefWindowProc(hWnd, msg, wParam, lParam);
 }
 
+// Startup decisions cached on disk by a cold start, so warm starts can skip choosing and probing them again.
+// The profile is only trusted while the GL renderer and version match the ones it was recorded with.
+struct StartupProfile
+{
+    char driverGL[256];
+    int pixelFormat;
+    int contextMajorVersion;
+    int contextMinorVersion;
+    int contextProfileMask;
+    int interopSupported;
+    int interopStrategy;
+    int depthFormat;
+    // Bit per ColorFormatIndex
+    int colorFormatsProbed;
+    int colorFormatsWorking;
+};
+
+void InitStartupProfile(StartupProfile* profile)
+{
+    memset(profile, 0, sizeof(*profile));
+    profile->contextMajorVersion = 4;
+    profile->contextMinorVersion = 3;
+    profile->contextProfileMask = WGL_CONTEXT_CORE_PROFILE_BIT_ARB;
+    profile->interopStrategy = -1;
+    profile->depthFormat = -1;
+}
+
+bool LoadStartupProfile(const char* path, StartupProfile* profile)
+{
+    InitStartupProfile(profile);
+
+    FILE* f;
+    if (fopen_s(&f, path, "r") != 0)
+    {
+        return false;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), f))
+    {
+        char* value = strchr(line, '=');
+        if (!value)
+        {
+            continue;
+        }
+        *value++ = '\0';
+        value[strcspn(value, "\r\n")] = '\0';
+
+        if (strcmp(line, "driverGL") == 0) strncpy_s(profile->driverGL, value, _TRUNCATE);
+        else if (strcmp(line, "pixelFormat") == 0) profile->pixelFormat = atoi(value);
+        else if (strcmp(line, "contextMajorVersion") == 0) profile->contextMajorVersion = atoi(value);
+        else if (strcmp(line, "contextMinorVersion") == 0) profile->contextMinorVersion = atoi(value);
+        else if (strcmp(line, "contextProfileMask") == 0) profile->contextProfileMask = atoi(value);
+        else if (strcmp(line, "interopSupported") == 0) profile->interopSupported = atoi(value);
+        else if (strcmp(line, "interopStrategy") == 0) profile->interopStrategy = atoi(value);
+        else if (strcmp(line, "depthFormat") == 0) profile->depthFormat = atoi(value);
+        else if (strcmp(line, "colorFormatsProbed") == 0) profile->colorFormatsProbed = atoi(value);
+        else if (strcmp(line, "colorFormatsWorking") == 0) profile->colorFormatsWorking = atoi(value);
+    }
+
+    fclose(f);
+    return profile->driverGL[0] != '\0';
+}
+
+void SaveStartupProfile(const char* path, const StartupProfile& profile)
+{
+    FILE* f;
+    if (fopen_s(&f, path, "w") != 0)
+    {
+        OutputDebugStringA("Failed to write startup profile\n");
+        return;
+    }
+
+    fprintf(f, "driverGL=%s\n", profile.driverGL);
+    fprintf(f, "pixelFormat=%d\n", profile.pixelFormat);
+    fprintf(f, "contextMajorVersion=%d\n", profile.contextMajorVersion);
+    fprintf(f, "contextMinorVersion=%d\n", profile.contextMinorVersion);
+    fprintf(f, "contextProfileMask=%d\n", profile.contextProfileMask);
+    fprintf(f, "interopSupported=%d\n", profile.interopSupported);
+    fprintf(f, "interopStrategy=%d\n", profile.interopStrategy);
+    fprintf(f, "depthFormat=%d\n", profile.depthFormat);
+    fprintf(f, "colorFormatsProbed=%d\n", profile.colorFormatsProbed);
+    fprintf(f, "colorFormatsWorking=%d\n", profile.colorFormatsWorking);
+    fclose(f);
+}
+
+// Milliseconds between two QueryPerformanceCounter readings
+double ElapsedMs(LARGE_INTEGER start, LARGE_INTEGER end)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return 1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart;
+}
+
+void LogFramebufferStatusGL(GLenum fbostatus)
+{
+    if (fbostatus == GL_FRAMEBUFFER_COMPLETE)
+    {
+        OutputDebugStringA("Framebuffer complete\n");
+    }
+    else
+    {   
+        OutputDebugStringA("Framebuffer not complete: ");
+        const char* errmsg = NULL;
+        switch (fbostatus)
+        {
+        case GL_FRAMEBUFFER_COMPLETE: errmsg = "GL_FRAMEBUFFER_COMPLETE"; break;
+        case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT"; break;
+        case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT"; break;
+        case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER"; break;
+        case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER"; break;
+        case GL_FRAMEBUFFER_UNSUPPORTED: errmsg = "GL_FRAMEBUFFER_UNSUPPORTED"; break;
+        case GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE"; break;
+        case GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS"; break;
+        }
+        if (errmsg)
+        {
+            OutputDebugStringA(errmsg);
+        }
+        OutputDebugStringA("\n");
+    }
+}
+
 bool CheckHR(HRESULT hr)
 {
     if (SUCCEEDED(hr))
@@ -71,295 +612,6342 @@ bool CheckWin32(BOOL okay)
     return CheckHR(HRESULT_FROM_WIN32(GetLastError()));
 }
 
-int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
+// High resolution timers need Windows 10 1803. Older versions fall back to a regular waitable timer.
+HANDLE CreateHighResolutionTimer()
 {
-    // Register window class
-    WNDCLASSEX wc = {};
-    wc.cbSize = sizeof(wc);
-    wc.style = CS_OWNDC;
-    wc.lpfnWndProc = WndProc;
-    wc.hInstance = GetModuleHandleW(NULL);
-    wc.hCursor = LoadCursorW(NULL, IDC_ARROW);
-    wc.lpszClassName = TEXT("WindowClass");
-    CheckWin32(RegisterClassExW(&wc) != NULL);
+    HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (timer == NULL)
+    {
+        timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+    }
+    CheckWin32(timer != NULL);
+    return timer;
+}
 
-    // Determine size of window based on window style
-    DWORD dwStyle = WS_OVERLAPPEDWINDOW;
-    DWORD dwExStyle = 0;
-    RECT wr = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
-    CheckWin32(AdjustWindowRectEx(&wr, dwStyle, FALSE, dwExStyle) != FALSE);
+// Sleep on a waitable timer until a QueryPerformanceCounter time
+void SleepUntil(HANDLE timer, LONGLONG deadline, LONGLONG qpcFrequency)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
 
-    TCHAR* title = TEXT("OpenGL on DXGI");
+    // Negative due times are relative, in 100ns units
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -((deadline - now.QuadPart) * 10000000 / qpcFrequency);
+    CheckWin32(SetWaitableTimer(timer, &dueTime, 0, NULL, NULL, FALSE));
+    CheckWin32(WaitForSingleObject(timer, INFINITE) == WAIT_OBJECT_0);
+}
 
-    // Create window
-    HWND hWnd = CreateWindowEx(
-        dwExStyle, TEXT("WindowClass"), title, dwStyle,
-        CW_USEDEFAULT, CW_USEDEFAULT,
-        wr.right - wr.left, wr.bottom - wr.top,
-        NULL, NULL, hInstance, NULL);
-    CheckWin32(hWnd != NULL);
+// Caps the frame rate by sleeping on a waitable timer until each frame's deadline
+struct FrameLimiter
+{
+    HANDLE timer;
+    LONGLONG qpcFrequency;
+    LONGLONG periodTicks;
+    LONGLONG nextDeadline;
 
-    // Unhide the window
-    ShowWindow(hWnd, SW_SHOWDEFAULT);
+    // How late the waits woke up since the last report
+    LONGLONG totalLateTicks;
+    LONGLONG maxLateTicks;
+    unsigned waits;
+};
 
-    // Create window that will be used to create a GL context
-    HWND gl_hWnd = CreateWindowEx(0, TEXT("WindowClass"), 0, 0, 0, 0, 0, 0, 0, 0, hInstance, 0);
-    CheckWin32(gl_hWnd != NULL);
+void InitFrameLimiter(FrameLimiter* limiter, double framesPerSecond)
+{
+    *limiter = {};
+    limiter->timer = CreateHighResolutionTimer();
 
-    HDC gl_hDC = GetDC(gl_hWnd);
-    CheckWin32(gl_hDC != NULL);
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    limiter->qpcFrequency = frequency.QuadPart;
+    limiter->periodTicks = (LONGLONG)(frequency.QuadPart / framesPerSecond);
+}
 
-    // set pixelformat for window that supports OpenGL
-    PIXELFORMATDESCRIPTOR gl_pfd = {};
-    gl_pfd.nSize = sizeof(gl_pfd);
-    gl_pfd.nVersion = 1;
-    gl_pfd.dwFlags = PFD_SUPPORT_OPENGL;
+// Wait until the next frame is allowed to start
+void WaitForNextFrame(FrameLimiter* limiter)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
 
-    int chosenPixelFormat = ChoosePixelFormat(gl_hDC, &gl_pfd);
-    CheckWin32(SetPixelFormat(gl_hDC, chosenPixelFormat, &gl_pfd) != FALSE);
+    if (limiter->nextDeadline == 0)
+    {
+        limiter->nextDeadline = now.QuadPart + limiter->periodTicks;
+        return;
+    }
 
-    // Create dummy GL context that will be used to create the real context
-    HGLRC dummy_hGLRC = wglCreateContext(gl_hDC);
-    CheckWin32(dummy_hGLRC != NULL);
+    LONGLONG remainingTicks = limiter->nextDeadline - now.QuadPart;
+    if (remainingTicks > 0)
+    {
+        SleepUntil(limiter->timer, limiter->nextDeadline, limiter->qpcFrequency);
+        QueryPerformanceCounter(&now);
 
-    // Use the dummy context to get function to create a better context
-    CheckWin32(wglMakeCurrent(gl_hDC, dummy_hGLRC) != FALSE);
+        LONGLONG lateTicks = now.QuadPart - limiter->nextDeadline;
+        if (lateTicks < 0)
+        {
+            lateTicks = -lateTicks;
+        }
+        limiter->totalLateTicks += lateTicks;
+        if (lateTicks > limiter->maxLateTicks)
+        {
+            limiter->maxLateTicks = lateTicks;
+        }
+        limiter->waits++;
+    }
 
-    PFNWGLCREATECONTEXTATTRIBSARBPROC wglCreateContextAttribsARB = (PFNWGLCREATECONTEXTATTRIBSARBPROC)wglGetProcAddress("wglCreateContextAttribsARB");
+    // A frame that overran by more than a period restarts the schedule, instead of rushing the following frames to catch up
+    if (now.QuadPart - limiter->nextDeadline > limiter->periodTicks)
+    {
+        limiter->nextDeadline = now.QuadPart + limiter->periodTicks;
+    }
+    else
+    {
+        limiter->nextDeadline += limiter->periodTicks;
+    }
+}
 
-    int contextFlagsGL = 0;
-#ifdef _DEBUG
-    contextFlagsGL |= WGL_CONTEXT_DEBUG_BIT_ARB;
-#endif
+// Check whether presents may tear, which variable refresh rate displays need to present immediately
+bool CheckTearingSupport(IDXGIFactory* dxgiFactory)
+{
+    IDXGIFactory5* dxgiFactory5;
+    if (FAILED(dxgiFactory->QueryInterface(&dxgiFactory5)))
+    {
+        return false;
+    }
 
-    int contextAttribsGL[] = {
-        WGL_CONTEXT_MAJOR_VERSION_ARB, 4,
-        WGL_CONTEXT_MINOR_VERSION_ARB, 3,
-        WGL_CONTEXT_FLAGS_ARB, contextFlagsGL,
-        WGL_CONTEXT_PROFILE_MASK_ARB, WGL_CONTEXT_CORE_PROFILE_BIT_ARB,
-        0
-    };
+    BOOL allowTearing = FALSE;
+    HRESULT hr = dxgiFactory5->CheckFeatureSupport(DXGI_FEATURE_PRESENT_ALLOW_TEARING, &allowTearing, sizeof(allowTearing));
+    dxgiFactory5->Release();
 
-    HGLRC hGLRC = wglCreateContextAttribsARB(gl_hDC, NULL, contextAttribsGL);
-    CheckWin32(hGLRC != NULL);
+    return SUCCEEDED(hr) && allowTearing;
+}
 
-    // Switch to the new context and ditch the old one
-    CheckWin32(wglMakeCurrent(gl_hDC, hGLRC) != FALSE);
-    CheckWin32(wglDeleteContext(dummy_hGLRC) != FALSE);
+// Immutable D3D11 state objects, looked up by a hash of their descriptor so each one is only created once
+enum StateObjectKind
+{
+    STATE_OBJECT_BLEND,
+    STATE_OBJECT_RASTERIZER,
+    STATE_OBJECT_DEPTH_STENCIL
+};
 
-    // Grab WGL functions
-    PFNWGLDXOPENDEVICENVPROC wglDXOpenDeviceNV = (PFNWGLDXOPENDEVICENVPROC)wglGetProcAddress("wglDXOpenDeviceNV");
-    PFNWGLDXREGISTEROBJECTNVPROC wglDXRegisterObjectNV = (PFNWGLDXREGISTEROBJECTNVPROC)wglGetProcAddress("wglDXRegisterObjectNV");
-    PFNWGLDXUNREGISTEROBJECTNVPROC wglDXUnregisterObjectNV = (PFNWGLDXUNREGISTEROBJECTNVPROC)wglGetProcAddress("wglDXUnregisterObjectNV");
-    PFNWGLDXLOCKOBJECTSNVPROC wglDXLockObjectsNV = (PFNWGLDXLOCKOBJECTSNVPROC)wglGetProcAddress("wglDXLockObjectsNV");
-    PFNWGLDXUNLOCKOBJECTSNVPROC wglDXUnlockObjectsNV = (PFNWGLDXUNLOCKOBJECTSNVPROC)wglGetProcAddress("wglDXUnlockObjectsNV");
+struct StateObjectCacheEntry
+{
+    StateObjectKind kind;
+    UINT64 hash;
+    union
+    {
+        D3D11_BLEND_DESC blend;
+        D3D11_RASTERIZER_DESC rasterizer;
+        D3D11_DEPTH_STENCIL_DESC depthStencil;
+    } desc;
+    ID3D11DeviceChild* object;
+};
 
-    // Fall back to GetProcAddress to get GL 1 functions. wglGetProcAddress returns NULL on those.
-    HMODULE hOpenGL32 = LoadLibrary(TEXT("OpenGL32.dll"));
+struct StateObjectCache
+{
+    StateObjectCacheEntry entries[STATE_OBJECT_CACHE_SIZE];
+    int count;
 
-    // Grab OpenGL functions
-    PFNGLENABLEPROC glEnable = (PFNGLENABLEPROC)GetProcAddress(hOpenGL32, "glEnable");
-    PFNGLDISABLEPROC glDisable = (PFNGLDISABLEPROC)GetProcAddress(hOpenGL32, "glDisable");
-    PFNGLCLEARPROC glClear = (PFNGLCLEARPROC)GetProcAddress(hOpenGL32, "glClear");
-    PFNGLCLEARCOLORPROC glClearColor = (PFNGLCLEARCOLORPROC)GetProcAddress(hOpenGL32, "glClearColor");
-    PFNGLSCISSORPROC glScissor = (PFNGLSCISSORPROC)GetProcAddress(hOpenGL32, "glScissor");
-    PFNGLGENTEXTURESPROC glGenTextures = (PFNGLGENTEXTURESPROC)GetProcAddress(hOpenGL32, "glGenTextures");
-    PFNGLGENFRAMEBUFFERSPROC glGenFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)wglGetProcAddress("glGenFramebuffers");
-    PFNGLBINDFRAMEBUFFERPROC glBindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC)wglGetProcAddress("glBindFramebuffer");
-    PFNGLFRAMEBUFFERTEXTURE2DPROC glFramebufferTexture2D = (PFNGLFRAMEBUFFERTEXTURE2DPROC)wglGetProcAddress("glFramebufferTexture2D");
-    PFNGLCHECKFRAMEBUFFERSTATUSPROC glCheckFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)wglGetProcAddress("glCheckFramebufferStatus");
+    // Lookups that found an existing object vs. ones that created one, since the last report
+    unsigned hits;
+    unsigned misses;
+    // Objects created while the cache was full, since the last report
+    unsigned uncached;
+};
 
-    // Enable OpenGL debugging
-#ifdef _DEBUG
-    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
-    glEnable(GL_DEBUG_OUTPUT);
-    PFNGLDEBUGMESSAGECALLBACKPROC glDebugMessageCallback = (PFNGLDEBUGMESSAGECALLBACKPROC)wglGetProcAddress("glDebugMessageCallback");
-    glDebugMessageCallback(DebugCallbackGL, 0);
-#endif
+static StateObjectCache g_stateObjects;
 
-    // create D3D11 device, context and swap chain.
-    ID3D11Device *device;
-    ID3D11DeviceContext *devCtx;
-    IDXGISwapChain *swapChain;
-#ifdef USE_WIN10_SWAPCHAIN
-    HANDLE hFrameLatencyWaitableObject;
-#endif
+// FNV-1a. Pass the previous hash to hash several buffers as one.
+// Descriptors with padding have to be copied into zeroed ones first, see the Canonical*Desc functions.
+UINT64 HashBytes(const void* data, size_t size, UINT64 hash = 14695981039346656037ull)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
 
-    DXGI_SWAP_CHAIN_DESC scd = {};
-    scd.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    scd.SampleDesc.Count = 1;
-    scd.BufferCount = DXGI_MAX_SWAP_CHAIN_BUFFERS; // TODO: This is a stress test. Should be set to a reasonable value instead, otherwise you'll get lots of latency.
-    scd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-    scd.OutputWindow = hWnd;
-    scd.Windowed = TRUE;
-#ifdef USE_WIN10_SWAPCHAIN
-    scd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
-    scd.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
-#else
-    scd.SwapEffect = DXGI_SWAP_EFFECT_DISCARD;
-#endif
+// Find the cached object with this descriptor, or NULL
+ID3D11DeviceChild* FindStateObject(StateObjectCache* cache, StateObjectKind kind, const void* desc, size_t descSize, UINT64 hash)
+{
+    for (int i = 0; i < cache->count; i++)
+    {
+        const StateObjectCacheEntry& entry = cache->entries[i];
+        if (entry.kind == kind && entry.hash == hash && memcmp(&entry.desc, desc, descSize) == 0)
+        {
+            cache->hits++;
+            return entry.object;
+        }
+    }
+    cache->misses++;
+    return NULL;
+}
+
+// When the cache is full the object isn't added, so it's created again by the next lookup.
+// That only costs a runtime call: D3D11 hands out the existing object again for an identical descriptor.
+void AddStateObject(StateObjectCache* cache, StateObjectKind kind, const void* desc, size_t descSize, UINT64 hash, ID3D11DeviceChild* object)
+{
+    if (cache->count == STATE_OBJECT_CACHE_SIZE)
+    {
+        cache->uncached++;
+        return;
+    }
+
+    StateObjectCacheEntry& entry = cache->entries[cache->count++];
+    entry.kind = kind;
+    entry.hash = hash;
+    memcpy(&entry.desc, desc, descSize);
+    entry.object = object;
+}
+
+// Copy a blend descriptor into a zeroed one, since the padding after each RenderTargetWriteMask would be hashed and compared otherwise
+void CanonicalBlendDesc(const D3D11_BLEND_DESC& desc, D3D11_BLEND_DESC* canonical)
+{
+    memset(canonical, 0, sizeof(*canonical));
+    canonical->AlphaToCoverageEnable = desc.AlphaToCoverageEnable;
+    canonical->IndependentBlendEnable = desc.IndependentBlendEnable;
+    for (int i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++)
+    {
+        const D3D11_RENDER_TARGET_BLEND_DESC& target = desc.RenderTarget[i];
+        D3D11_RENDER_TARGET_BLEND_DESC& canonicalTarget = canonical->RenderTarget[i];
+        canonicalTarget.BlendEnable = target.BlendEnable;
+        canonicalTarget.SrcBlend = target.SrcBlend;
+        canonicalTarget.DestBlend = target.DestBlend;
+        canonicalTarget.BlendOp = target.BlendOp;
+        canonicalTarget.SrcBlendAlpha = target.SrcBlendAlpha;
+        canonicalTarget.DestBlendAlpha = target.DestBlendAlpha;
+        canonicalTarget.BlendOpAlpha = target.BlendOpAlpha;
+        canonicalTarget.RenderTargetWriteMask = target.RenderTargetWriteMask;
+    }
+}
+
+// Same, for the padding after the stencil masks
+void CanonicalDepthStencilDesc(const D3D11_DEPTH_STENCIL_DESC& desc, D3D11_DEPTH_STENCIL_DESC* canonical)
+{
+    memset(canonical, 0, sizeof(*canonical));
+    canonical->DepthEnable = desc.DepthEnable;
+    canonical->DepthWriteMask = desc.DepthWriteMask;
+    canonical->DepthFunc = desc.DepthFunc;
+    canonical->StencilEnable = desc.StencilEnable;
+    canonical->StencilReadMask = desc.StencilReadMask;
+    canonical->StencilWriteMask = desc.StencilWriteMask;
+    canonical->FrontFace = desc.FrontFace;
+    canonical->BackFace = desc.BackFace;
+}
+
+// Every object the cache creates is counted, since a miss in a steady-state frame is an allocation like any other.
+// The cache keeps the reference, so the returned objects must not be released
+ID3D11BlendState* GetBlendState(StateObjectCache* cache, ID3D11Device* device, const D3D11_BLEND_DESC& blendDesc)
+{
+    D3D11_BLEND_DESC desc;
+    CanonicalBlendDesc(blendDesc, &desc);
+    UINT64 hash = HashBytes(&desc, sizeof(desc));
+    ID3D11DeviceChild* object = FindStateObject(cache, STATE_OBJECT_BLEND, &desc, sizeof(desc), hash);
+    if (!object)
+    {
+        ID3D11BlendState* state;
+        CheckHR(device->CreateBlendState(&desc, &state));
+        CountComAlloc();
+        AddStateObject(cache, STATE_OBJECT_BLEND, &desc, sizeof(desc), hash, state);
+        object = state;
+    }
+    return (ID3D11BlendState*)object;
+}
+
+// The rasterizer descriptor is all 4-byte fields, so it has no padding and is hashed as it is
+ID3D11RasterizerState* GetRasterizerState(StateObjectCache* cache, ID3D11Device* device, const D3D11_RASTERIZER_DESC& desc)
+{
+    UINT64 hash = HashBytes(&desc, sizeof(desc));
+    ID3D11DeviceChild* object = FindStateObject(cache, STATE_OBJECT_RASTERIZER, &desc, sizeof(desc), hash);
+    if (!object)
+    {
+        ID3D11RasterizerState* state;
+        CheckHR(device->CreateRasterizerState(&desc, &state));
+        CountComAlloc();
+        AddStateObject(cache, STATE_OBJECT_RASTERIZER, &desc, sizeof(desc), hash, state);
+        object = state;
+    }
+    return (ID3D11RasterizerState*)object;
+}
+
+ID3D11DepthStencilState* GetDepthStencilState(StateObjectCache* cache, ID3D11Device* device, const D3D11_DEPTH_STENCIL_DESC& depthStencilDesc)
+{
+    D3D11_DEPTH_STENCIL_DESC desc;
+    CanonicalDepthStencilDesc(depthStencilDesc, &desc);
+    UINT64 hash = HashBytes(&desc, sizeof(desc));
+    ID3D11DeviceChild* object = FindStateObject(cache, STATE_OBJECT_DEPTH_STENCIL, &desc, sizeof(desc), hash);
+    if (!object)
+    {
+        ID3D11DepthStencilState* state;
+        CheckHR(device->CreateDepthStencilState(&desc, &state));
+        CountComAlloc();
+        AddStateObject(cache, STATE_OBJECT_DEPTH_STENCIL, &desc, sizeof(desc), hash, state);
+        object = state;
+    }
+    return (ID3D11DepthStencilState*)object;
+}
+
+// Shadow copy of what's bound to a device context, so redundant bindings never reach the runtime.
+// Bound views are referenced by the context, so a pointer can't be reused by a new view while it's still bound here.
+struct D3DStateTracker
+{
+    ID3D11DeviceContext* context;
+
+    ID3D11RenderTargetView* renderTarget;
+    ID3D11DepthStencilView* depthStencil;
+    D3D11_VIEWPORT viewport;
+    bool viewportValid;
+    ID3D11BlendState* blendState;
+    float blendFactor[4];
+    UINT sampleMask;
+    ID3D11RasterizerState* rasterizerState;
+    ID3D11DepthStencilState* depthStencilState;
+    UINT stencilRef;
+
+    // Calls that went to the runtime vs. calls that were filtered, since the last report
+    unsigned issued;
+    unsigned filtered;
+};
+
+// Matches the state of a device context that was just created or cleared
+void InitD3DStateTracker(D3DStateTracker* tracker, ID3D11DeviceContext* context)
+{
+    unsigned issued = tracker->issued;
+    unsigned filtered = tracker->filtered;
+    *tracker = {};
+    tracker->context = context;
+    for (int i = 0; i < 4; i++)
+    {
+        tracker->blendFactor[i] = 1.0f;
+    }
+    tracker->sampleMask = 0xFFFFFFFF;
+    tracker->issued = issued;
+    tracker->filtered = filtered;
+}
+
+void SetRenderTargetD3D(D3DStateTracker* tracker, ID3D11RenderTargetView* renderTarget, ID3D11DepthStencilView* depthStencil)
+{
+    if (tracker->renderTarget == renderTarget && tracker->depthStencil == depthStencil)
+    {
+        tracker->filtered++;
+        return;
+    }
+
+    tracker->context->OMSetRenderTargets(renderTarget ? 1 : 0, &renderTarget, depthStencil);
+    tracker->renderTarget = renderTarget;
+    tracker->depthStencil = depthStencil;
+    tracker->issued++;
+}
+
+void SetViewportD3D(D3DStateTracker* tracker, const D3D11_VIEWPORT& viewport)
+{
+    if (tracker->viewportValid && memcmp(&tracker->viewport, &viewport, sizeof(viewport)) == 0)
+    {
+        tracker->filtered++;
+        return;
+    }
+
+    tracker->context->RSSetViewports(1, &viewport);
+    tracker->viewport = viewport;
+    tracker->viewportValid = true;
+    tracker->issued++;
+}
+
+void SetBlendStateD3D(D3DStateTracker* tracker, ID3D11BlendState* blendState, const float blendFactor[4], UINT sampleMask)
+{
+    if (tracker->blendState == blendState &&
+        memcmp(tracker->blendFactor, blendFactor, sizeof(tracker->blendFactor)) == 0 &&
+        tracker->sampleMask == sampleMask)
+    {
+        tracker->filtered++;
+        return;
+    }
+
+    tracker->context->OMSetBlendState(blendState, blendFactor, sampleMask);
+    tracker->blendState = blendState;
+    memcpy(tracker->blendFactor, blendFactor, sizeof(tracker->blendFactor));
+    tracker->sampleMask = sampleMask;
+    tracker->issued++;
+}
+
+void SetRasterizerStateD3D(D3DStateTracker* tracker, ID3D11RasterizerState* rasterizerState)
+{
+    if (tracker->rasterizerState == rasterizerState)
+    {
+        tracker->filtered++;
+        return;
+    }
+
+    tracker->context->RSSetState(rasterizerState);
+    tracker->rasterizerState = rasterizerState;
+    tracker->issued++;
+}
+
+void SetDepthStencilStateD3D(D3DStateTracker* tracker, ID3D11DepthStencilState* depthStencilState, UINT stencilRef)
+{
+    if (tracker->depthStencilState == depthStencilState && tracker->stencilRef == stencilRef)
+    {
+        tracker->filtered++;
+        return;
+    }
+
+    tracker->context->OMSetDepthStencilState(depthStencilState, stencilRef);
+    tracker->depthStencilState = depthStencilState;
+    tracker->stencilRef = stencilRef;
+    tracker->issued++;
+}
+
+// A unit of work in a task graph. Jobs are allocated from the frame allocators and only live until the end of the frame.
+struct Job
+{
+    void (*function)(void* data);
+    void* data;
+
+    // The job is queued once this reaches 0. Submitting the job counts as one of them.
+    std::atomic<int> unfinishedDependencies;
+    std::atomic<bool> finished;
+
+    // Jobs that depend on this one
+    Job* continuations[MAX_JOB_CONTINUATIONS];
+    int continuationCount;
+};
+
+// The owning thread pushes and pops at the bottom, other threads steal from the top
+struct JobDeque
+{
+    SRWLOCK lock;
+    Job* jobs[JOB_DEQUE_CAPACITY];
+    unsigned top;
+    unsigned bottom;
+};
+
+// Bump allocator that's reset at the start of every frame
+struct FrameAllocator
+{
+    unsigned char* memory;
+    size_t used;
+    size_t peak; // since the last report
+};
+
+struct JobSystem
+{
+    // Thread 0 is the thread that created the job system, and it runs jobs while it waits for them
+    int threadCount;
+    JobDeque deques[MAX_JOB_THREADS];
+    FrameAllocator allocators[MAX_JOB_THREADS];
+
+    // Released once per queued job, so idle threads sleep until there's something to steal
+    HANDLE workAvailable;
+    std::atomic<bool> quit;
+    std::atomic<int> runningThreads;
+
+    // Jobs queued or still running. RunJob touches the job after queuing its continuations,
+    // so a job being finished doesn't mean the threads are done with the frame memory.
+    std::atomic<int> outstandingJobs;
+
+    // Since the last report
+    std::atomic<unsigned> jobsRun;
+    std::atomic<unsigned> steals;
+};
+
+static JobSystem g_jobSystem;
+
+// Index of the current thread in the job system, 0 for threads that aren't job threads
+static thread_local int t_jobThreadIndex;
+
+void* AllocateFrameMemory(JobSystem* jobs, size_t size)
+{
+    FrameAllocator& allocator = jobs->allocators[t_jobThreadIndex];
+    size_t offset = (allocator.used + 15) & ~(size_t)15;
+    // Not an assert, since running past the allocator would corrupt the heap in release builds
+    if (offset + size > FRAME_ALLOCATOR_SIZE)
+    {
+        CheckHR(E_OUTOFMEMORY);
+    }
+    allocator.used = offset + size;
+    allocator.peak = allocator.used > allocator.peak ? allocator.used : allocator.peak;
+    return allocator.memory + offset;
+}
+
+void PushJob(JobSystem* jobs, Job* job)
+{
+    jobs->outstandingJobs++;
+    JobDeque& deque = jobs->deques[t_jobThreadIndex];
+    AcquireSRWLockExclusive(&deque.lock);
+    // Same, a full deque would overwrite queued jobs
+    if (deque.bottom - deque.top >= JOB_DEQUE_CAPACITY)
+    {
+        CheckHR(E_OUTOFMEMORY);
+    }
+    deque.jobs[deque.bottom++ % JOB_DEQUE_CAPACITY] = job;
+    ReleaseSRWLockExclusive(&deque.lock);
+
+    ReleaseSemaphore(jobs->workAvailable, 1, NULL);
+}
+
+// Take the newest job of this thread, or steal the oldest job of another thread
+Job* FindJob(JobSystem* jobs)
+{
+    int self = t_jobThreadIndex;
+    for (int i = 0; i < jobs->threadCount; i++)
+    {
+        JobDeque& deque = jobs->deques[(self + i) % jobs->threadCount];
+        Job* job = NULL;
+        AcquireSRWLockExclusive(&deque.lock);
+        if (deque.bottom != deque.top)
+        {
+            job = i == 0 ? deque.jobs[--deque.bottom % JOB_DEQUE_CAPACITY] : deque.jobs[deque.top++ % JOB_DEQUE_CAPACITY];
+        }
+        ReleaseSRWLockExclusive(&deque.lock);
+
+        if (job)
+        {
+            if (i != 0)
+            {
+                jobs->steals++;
+            }
+            return job;
+        }
+    }
+    return NULL;
+}
+
+void RunJob(JobSystem* jobs, Job* job)
+{
+    job->function(job->data);
+    jobs->jobsRun++;
+
+    for (int i = 0; i < job->continuationCount; i++)
+    {
+        if (--job->continuations[i]->unfinishedDependencies == 0)
+        {
+            PushJob(jobs, job->continuations[i]);
+        }
+    }
+    job->finished.store(true, std::memory_order_release);
+
+    // Last, since the job may be reset with the frame memory as soon as this reaches 0
+    jobs->outstandingJobs.fetch_sub(1, std::memory_order_release);
+}
+
+void JobThreadMain(JobSystem* jobs, int index)
+{
+    t_jobThreadIndex = index;
+    while (!jobs->quit)
+    {
+        Job* job = FindJob(jobs);
+        if (job)
+        {
+            RunJob(jobs, job);
+        }
+        else
+        {
+            WaitForSingleObject(jobs->workAvailable, INFINITE);
+        }
+    }
+    jobs->runningThreads--;
+}
+
+void InitJobSystem(JobSystem* jobs, int threadCount)
+{
+    assert(threadCount >= 1 && threadCount <= MAX_JOB_THREADS);
+    jobs->threadCount = threadCount;
+    jobs->quit = false;
+    jobs->outstandingJobs = 0;
+    jobs->workAvailable = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+    CheckWin32(jobs->workAvailable != NULL);
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        InitializeSRWLock(&jobs->deques[i].lock);
+        jobs->deques[i].top = 0;
+        jobs->deques[i].bottom = 0;
+        jobs->allocators[i].memory = new unsigned char[FRAME_ALLOCATOR_SIZE];
+        jobs->allocators[i].used = 0;
+        jobs->allocators[i].peak = 0;
+    }
+
+    // The threads are detached, and ShutdownJobSystem waits for them to leave instead
+    jobs->runningThreads = threadCount - 1;
+    for (int i = 1; i < threadCount; i++)
+    {
+        std::thread(JobThreadMain, jobs, i).detach();
+    }
+}
+
+// Only call when no jobs are queued or running
+void ShutdownJobSystem(JobSystem* jobs)
+{
+    jobs->quit = true;
+    ReleaseSemaphore(jobs->workAvailable, jobs->threadCount, NULL);
+    while (jobs->runningThreads > 0)
+    {
+        SwitchToThread();
+    }
+
+    CloseHandle(jobs->workAvailable);
+    for (int i = 0; i < jobs->threadCount; i++)
+    {
+        delete[] jobs->allocators[i].memory;
+    }
+}
+
+// The job isn't queued until it's submitted, so dependencies can be added to it first
+Job* CreateJob(JobSystem* jobs, void (*function)(void* data), void* data)
+{
+    Job* job = new (AllocateFrameMemory(jobs, sizeof(Job))) Job;
+    job->function = function;
+    job->data = data;
+    job->unfinishedDependencies = 1;
+    job->finished = false;
+    job->continuationCount = 0;
+    return job;
+}
+
+// Make "then" wait for "first". Both must be created but not submitted yet.
+void AddJobDependency(Job* first, Job* then)
+{
+    assert(first->continuationCount < MAX_JOB_CONTINUATIONS);
+    first->continuations[first->continuationCount++] = then;
+    then->unfinishedDependencies++;
+}
+
+void SubmitJob(JobSystem* jobs, Job* job)
+{
+    if (--job->unfinishedDependencies == 0)
+    {
+        PushJob(jobs, job);
+    }
+}
+
+// Run other jobs until this one is finished
+void WaitForJob(JobSystem* jobs, Job* job)
+{
+    while (!job->finished.load(std::memory_order_acquire))
+    {
+        Job* other = FindJob(jobs);
+        if (other)
+        {
+            RunJob(jobs, other);
+        }
+        else
+        {
+            SwitchToThread();
+        }
+    }
+}
+
+// Only call between frames, once the jobs of the last frame are finished.
+// Waits for the threads that ran them to let go of them, since they live in the memory that's reset.
+void ResetFrameAllocators(JobSystem* jobs)
+{
+    while (jobs->outstandingJobs.load(std::memory_order_acquire) > 0)
+    {
+        Job* other = FindJob(jobs);
+        if (other)
+        {
+            RunJob(jobs, other);
+        }
+        else
+        {
+            SwitchToThread();
+        }
+    }
+
+    for (int i = 0; i < jobs->threadCount; i++)
+    {
+        jobs->allocators[i].used = 0;
+    }
+}
+
+void EmptyJob(void*)
+{
+}
+
+// A range of items processed by one job
+struct JobRange
+{
+    float* items;
+    int first;
+    int last;
+};
+
+// Some arithmetic per item, standing in for per-object work like culling
+void JobBenchmarkWork(void* data)
+{
+    JobRange* range = (JobRange*)data;
+    for (int i = range->first; i < range->last; i++)
+    {
+        float value = range->items[i];
+        for (int k = 0; k < 16; k++)
+        {
+            value = sinf(value) * 0.5f + cosf(value * 0.25f);
+        }
+        range->items[i] = value;
+    }
+}
+
+// Run the same two-stage task graph on 1 to N threads, to show how the job system scales
+void BenchmarkJobSystem()
+{
+    unsigned hardwareThreads = std::thread::hardware_concurrency();
+    int maxThreads = hardwareThreads == 0 ? 1 : hardwareThreads > MAX_JOB_THREADS ? MAX_JOB_THREADS : (int)hardwareThreads;
+
+    float* items = new float[JOB_BENCHMARK_ITEMS];
+    JobSystem* jobs = new JobSystem();
+    double singleThreadMs = 0.0;
+    for (int threadCount = 1; threadCount <= maxThreads; threadCount++)
+    {
+        for (int i = 0; i < JOB_BENCHMARK_ITEMS; i++)
+        {
+            items[i] = (float)i;
+        }
+        InitJobSystem(jobs, threadCount);
+
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+        for (int graph = 0; graph < JOB_BENCHMARK_GRAPHS; graph++)
+        {
+            ResetFrameAllocators(jobs);
+            Job* done = CreateJob(jobs, EmptyJob, NULL);
+            for (int first = 0; first < JOB_BENCHMARK_ITEMS; first += JOB_GRAIN_SIZE)
+            {
+                JobRange* range = (JobRange*)AllocateFrameMemory(jobs, sizeof(JobRange));
+                range->items = items;
+                range->first = first;
+                range->last = first + JOB_GRAIN_SIZE;
+
+                // The second pass over a range depends on the first, like a cull followed by a batch build
+                Job* firstPass = CreateJob(jobs, JobBenchmarkWork, range);
+                Job* secondPass = CreateJob(jobs, JobBenchmarkWork, range);
+                AddJobDependency(firstPass, secondPass);
+                AddJobDependency(secondPass, done);
+                SubmitJob(jobs, firstPass);
+                SubmitJob(jobs, secondPass);
+            }
+            SubmitJob(jobs, done);
+            WaitForJob(jobs, done);
+        }
+        LARGE_INTEGER end;
+        QueryPerformanceCounter(&end);
+
+        double graphMs = ElapsedMs(start, end) / JOB_BENCHMARK_GRAPHS;
+        if (threadCount == 1)
+        {
+            singleThreadMs = graphMs;
+        }
+
+        char buf[128];
+        sprintf_s(buf, "Job system with %d threads: %.3f ms per graph, %.2fx, %u steals\n",
+            threadCount, graphMs, singleThreadMs / graphMs, (unsigned)jobs->steals);
+        OutputDebugStringA(buf);
+
+        ShutdownJobSystem(jobs);
+        jobs->jobsRun = 0;
+        jobs->steals = 0;
+    }
+    delete jobs;
+    delete[] items;
+}
+
+// A range of benchmark objects drawn by one API between two handoffs
+struct DrawRecord
+{
+    int first;
+    int last;
+};
+
+// Linear allocator for the main thread's transient per-frame data, like lock handle arrays and draw lists.
+// It's split into FRAME_ARENA_FRAMES regions, one per frame in flight. A region is only reset once
+// the GPU has finished the frame that last allocated from it, which an event query issued at the end of that frame tells.
+// Allocations that don't fit in a region come from the heap instead, are freed with the region, and are reported as overflows.
+struct FrameArena
+{
+    ID3D11DeviceContext* context; // NULL if the arena isn't tied to GPU frames
+    unsigned char* regions[FRAME_ARENA_FRAMES];
+    ID3D11Query* fences[FRAME_ARENA_FRAMES];
+    bool fenceIssued[FRAME_ARENA_FRAMES];
+    void* overflowBlocks[FRAME_ARENA_FRAMES]; // linked through their first bytes
+    int region;
+    size_t used;
+    size_t overflowUsed;
+
+    // Since the last report
+    size_t peak;
+    unsigned overflows;
+    unsigned fenceWaits;
+};
+
+static FrameArena g_frameArena;
+
+// Heap blocks of overflowing allocations start with this many bytes for the link, which keeps the allocation aligned
+#define FRAME_ARENA_OVERFLOW_HEADER 16
+
+void InitFrameArena(FrameArena* arena, ID3D11Device* device, ID3D11DeviceContext* context)
+{
+    arena->context = context;
+    for (int i = 0; i < FRAME_ARENA_FRAMES; i++)
+    {
+        arena->regions[i] = new unsigned char[FRAME_ARENA_SIZE];
+        arena->fences[i] = NULL;
+        if (context)
+        {
+            CheckHR(device->CreateQuery(&CD3D11_QUERY_DESC(D3D11_QUERY_EVENT), &arena->fences[i]));
+        }
+        arena->fenceIssued[i] = false;
+        arena->overflowBlocks[i] = NULL;
+    }
+    arena->region = 0;
+    arena->used = 0;
+    arena->overflowUsed = 0;
+    arena->peak = 0;
+    arena->overflows = 0;
+    arena->fenceWaits = 0;
+}
+
+void FreeOverflowBlocks(FrameArena* arena, int region)
+{
+    void* block = arena->overflowBlocks[region];
+    while (block)
+    {
+        void* next = *(void**)block;
+        free(block);
+        block = next;
+    }
+    arena->overflowBlocks[region] = NULL;
+}
+
+void DestroyFrameArena(FrameArena* arena)
+{
+    for (int i = 0; i < FRAME_ARENA_FRAMES; i++)
+    {
+        FreeOverflowBlocks(arena, i);
+        delete[] arena->regions[i];
+        if (arena->fences[i])
+        {
+            arena->fences[i]->Release();
+        }
+    }
+}
+
+// Move on to the next region, waiting for the GPU to finish the frame that used it last
+void BeginFrameArena(FrameArena* arena)
+{
+    arena->region = (arena->region + 1) % FRAME_ARENA_FRAMES;
+    if (arena->fenceIssued[arena->region])
+    {
+        ID3D11Query* fence = arena->fences[arena->region];
+        if (arena->context->GetData(fence, NULL, 0, 0) != S_OK)
+        {
+            arena->fenceWaits++;
+            while (arena->context->GetData(fence, NULL, 0, 0) != S_OK)
+            {
+                SwitchToThread();
+            }
+        }
+        arena->fenceIssued[arena->region] = false;
+    }
+
+    FreeOverflowBlocks(arena, arena->region);
+    arena->used = 0;
+    arena->overflowUsed = 0;
+}
+
+// Mark the end of the frame's GPU work, after which its region can be reused
+void EndFrameArena(FrameArena* arena)
+{
+    if (arena->context)
+    {
+        arena->context->End(arena->fences[arena->region]);
+        arena->fenceIssued[arena->region] = true;
+    }
+}
+
+void* AllocateFrameArena(FrameArena* arena, size_t size, size_t alignment)
+{
+    assert(alignment <= FRAME_ARENA_OVERFLOW_HEADER && (alignment & (alignment - 1)) == 0);
+
+    void* allocation;
+    size_t offset = (arena->used + alignment - 1) & ~(alignment - 1);
+    if (offset + size <= FRAME_ARENA_SIZE)
+    {
+        allocation = arena->regions[arena->region] + offset;
+        arena->used = offset + size;
+    }
+    else
+    {
+        arena->overflows++;
+        unsigned char* block = (unsigned char*)MallocCounted(FRAME_ARENA_OVERFLOW_HEADER + size);
+        assert(block);
+        *(void**)block = arena->overflowBlocks[arena->region];
+        arena->overflowBlocks[arena->region] = block;
+        allocation = block + FRAME_ARENA_OVERFLOW_HEADER;
+        arena->overflowUsed += size;
+    }
+
+    size_t total = arena->used + arena->overflowUsed;
+    arena->peak = total > arena->peak ? total : arena->peak;
+    return allocation;
+}
+
+// Handles to pass to wglDXLockObjectsNV/wglDXUnlockObjectsNV, valid until the arena's region is reused
+HANDLE* AllocateInteropHandles(FrameArena* arena, int count)
+{
+    return (HANDLE*)AllocateFrameArena(arena, count * sizeof(HANDLE), alignof(HANDLE));
+}
+
+DrawRecord* AllocateDrawRecords(FrameArena* arena, int count)
+{
+    return (DrawRecord*)AllocateFrameArena(arena, count * sizeof(DrawRecord), alignof(DrawRecord));
+}
+
+// Time a frame's worth of lock handle arrays and draw lists allocated from a frame arena against malloc/free
+void BenchmarkFrameArena()
+{
+    FrameArena arena;
+    InitFrameArena(&arena, NULL, NULL);
+    void** blocks = new void*[FRAME_ARENA_BENCHMARK_ALLOCATIONS];
+
+    // Everything allocated is written to, so neither loop can skip its allocations
+    unsigned checksum = 0;
+
+    LARGE_INTEGER arenaStart;
+    QueryPerformanceCounter(&arenaStart);
+    for (int frame = 0; frame < FRAME_ARENA_BENCHMARK_FRAMES; frame++)
+    {
+        BeginFrameArena(&arena);
+        for (int i = 0; i < FRAME_ARENA_BENCHMARK_ALLOCATIONS; i++)
+        {
+            if (i & 1)
+            {
+                HANDLE* handles = AllocateInteropHandles(&arena, 2 + i % 8);
+                handles[0] = (HANDLE)(size_t)i;
+                checksum += (unsigned)(size_t)handles[0];
+            }
+            else
+            {
+                DrawRecord* records = AllocateDrawRecords(&arena, 1 + i % 16);
+                records[0].first = i;
+                checksum += records[0].first;
+            }
+        }
+        EndFrameArena(&arena);
+    }
+    LARGE_INTEGER arenaEnd;
+    QueryPerformanceCounter(&arenaEnd);
+
+    LARGE_INTEGER mallocStart;
+    QueryPerformanceCounter(&mallocStart);
+    for (int frame = 0; frame < FRAME_ARENA_BENCHMARK_FRAMES; frame++)
+    {
+        for (int i = 0; i < FRAME_ARENA_BENCHMARK_ALLOCATIONS; i++)
+        {
+            if (i & 1)
+            {
+                HANDLE* handles = (HANDLE*)malloc((2 + i % 8) * sizeof(HANDLE));
+                handles[0] = (HANDLE)(size_t)i;
+                checksum += (unsigned)(size_t)handles[0];
+                blocks[i] = handles;
+            }
+            else
+            {
+                DrawRecord* records = (DrawRecord*)malloc((1 + i % 16) * sizeof(DrawRecord));
+                records[0].first = i;
+                checksum += records[0].first;
+                blocks[i] = records;
+            }
+        }
+        for (int i = 0; i < FRAME_ARENA_BENCHMARK_ALLOCATIONS; i++)
+        {
+            free(blocks[i]);
+        }
+    }
+    LARGE_INTEGER mallocEnd;
+    QueryPerformanceCounter(&mallocEnd);
+
+    char buf[256];
+    sprintf_s(buf, "Frame arena: %.3f ms for %d frames of %d allocations, malloc/free %.3f ms (peak %u bytes, %u overflows, checksum %u)\n",
+        ElapsedMs(arenaStart, arenaEnd),
+        FRAME_ARENA_BENCHMARK_FRAMES,
+        FRAME_ARENA_BENCHMARK_ALLOCATIONS,
+        ElapsedMs(mallocStart, mallocEnd),
+        (unsigned)arena.peak,
+        arena.overflows,
+        checksum);
+    OutputDebugStringA(buf);
+
+    delete[] blocks;
+    DestroyFrameArena(&arena);
+}
+
+// WGL functions
+static PFNWGLDXOPENDEVICENVPROC wglDXOpenDeviceNV;
+static PFNWGLDXREGISTEROBJECTNVPROC wglDXRegisterObjectNV;
+static PFNWGLDXUNREGISTEROBJECTNVPROC wglDXUnregisterObjectNV;
+static PFNWGLDXLOCKOBJECTSNVPROC wglDXLockObjectsNV;
+static PFNWGLDXUNLOCKOBJECTSNVPROC wglDXUnlockObjectsNV;
+
+// OpenGL functions
+static PFNGLENABLEPROC glEnable;
+static PFNGLDISABLEPROC glDisable;
+static PFNGLCLEARPROC glClear;
+static PFNGLCLEARCOLORPROC glClearColor;
+static PFNGLSCISSORPROC glScissor;
+static PFNGLGENTEXTURESPROC glGenTextures;
+static PFNGLDELETETEXTURESPROC glDeleteTextures;
+static PFNGLBINDTEXTUREPROC glBindTexture;
+static PFNGLTEXPARAMETERIPROC glTexParameteri;
+static PFNGLGETSTRINGPROC glGetString;
+static PFNGLGENFRAMEBUFFERSPROC glGenFramebuffers;
+static PFNGLDELETEFRAMEBUFFERSPROC glDeleteFramebuffers;
+static PFNGLBINDFRAMEBUFFERPROC glBindFramebuffer;
+static PFNGLFRAMEBUFFERTEXTURE2DPROC glFramebufferTexture2D;
+static PFNGLGENRENDERBUFFERSPROC glGenRenderbuffers;
+static PFNGLDELETERENDERBUFFERSPROC glDeleteRenderbuffers;
+static PFNGLFRAMEBUFFERRENDERBUFFERPROC glFramebufferRenderbuffer;
+static PFNGLCHECKFRAMEBUFFERSTATUSPROC glCheckFramebufferStatus;
+static PFNGLGETINTERNALFORMATIVPROC glGetInternalformativ;
+static PFNGLVIEWPORTPROC glViewport;
+static PFNGLDRAWARRAYSPROC glDrawArrays;
+static PFNGLDRAWARRAYSINSTANCEDPROC glDrawArraysInstanced;
+static PFNGLGETINTEGERVPROC glGetIntegerv;
+static PFNGLGENBUFFERSPROC glGenBuffers;
+static PFNGLBINDBUFFERPROC glBindBuffer;
+static PFNGLBINDBUFFERRANGEPROC glBindBufferRange;
+static PFNGLBINDBUFFERBASEPROC glBindBufferBase;
+static PFNGLDELETEBUFFERSPROC glDeleteBuffers;
+static PFNGLBUFFERSTORAGEPROC glBufferStorage;
+static PFNGLMAPBUFFERRANGEPROC glMapBufferRange;
+static PFNGLVERTEXATTRIBIPOINTERPROC glVertexAttribIPointer;
+static PFNGLVERTEXATTRIBDIVISORPROC glVertexAttribDivisor;
+static PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray;
+static PFNGLMULTIDRAWELEMENTSINDIRECTPROC glMultiDrawElementsIndirect;
+static PFNGLFENCESYNCPROC glFenceSync;
+static PFNGLCLIENTWAITSYNCPROC glClientWaitSync;
+static PFNGLDELETESYNCPROC glDeleteSync;
+static PFNGLDISPATCHCOMPUTEPROC glDispatchCompute;
+static PFNGLMEMORYBARRIERPROC glMemoryBarrier;
+static PFNGLBINDIMAGETEXTUREPROC glBindImageTexture;
+static PFNGLCREATESHADERPROC glCreateShader;
+static PFNGLDELETESHADERPROC glDeleteShader;
+static PFNGLSHADERSOURCEPROC glShaderSource;
+static PFNGLCOMPILESHADERPROC glCompileShader;
+static PFNGLGETSHADERIVPROC glGetShaderiv;
+static PFNGLGETSHADERINFOLOGPROC glGetShaderInfoLog;
+static PFNGLCREATEPROGRAMPROC glCreateProgram;
+static PFNGLATTACHSHADERPROC glAttachShader;
+static PFNGLLINKPROGRAMPROC glLinkProgram;
+static PFNGLGETPROGRAMIVPROC glGetProgramiv;
+static PFNGLGETPROGRAMINFOLOGPROC glGetProgramInfoLog;
+static PFNGLDELETEPROGRAMPROC glDeleteProgram;
+static PFNGLPROGRAMPARAMETERIPROC glProgramParameteri;
+static PFNGLGETPROGRAMBINARYPROC glGetProgramBinary;
+static PFNGLPROGRAMBINARYPROC glProgramBinary;
+static PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR;
+static PFNGLGETSTRINGIPROC glGetStringi;
+static PFNGLUSEPROGRAMPROC glUseProgram;
+static PFNGLGETUNIFORMLOCATIONPROC glGetUniformLocation;
+static PFNGLUNIFORM1FPROC glUniform1f;
+static PFNGLUNIFORM4FVPROC glUniform4fv;
+static PFNGLGENVERTEXARRAYSPROC glGenVertexArrays;
+static PFNGLBINDVERTEXARRAYPROC glBindVertexArray;
+
+// Shadow copy of the GL state that the frame loop sets, so redundant calls never reach the driver.
+// Everything that changes this state should go through the Set*GL functions below.
+struct GLStateCache
+{
+    bool valid; // false until the first call on the context, since the driver state is unknown
+    GLuint framebuffer;
+    bool scissorTest;
+    bool depthTest;
+    GLfloat clearColor[4];
+    GLint scissor[4];
+    GLint viewport[4];
+
+    // Calls that went to the driver vs. calls that were filtered, since the last report
+    unsigned issued;
+    unsigned filtered;
+};
+
+static GLStateCache g_glState;
+
+// The first call issues everything, since the cache starts out not knowing the driver state
+void ValidateStateGL()
+{
+    if (g_glState.valid)
+    {
+        return;
+    }
+
+    g_glState.valid = true;
+    g_glState.framebuffer = (GLuint)-1;
+    g_glState.scissorTest = false;
+    g_glState.depthTest = false;
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_DEPTH_TEST);
+    g_glState.issued += 2;
+    for (int i = 0; i < 4; i++)
+    {
+        g_glState.clearColor[i] = -1.0f;
+        g_glState.scissor[i] = -1;
+        g_glState.viewport[i] = -1;
+    }
+}
+
+void BindFramebufferGL(GLuint framebuffer)
+{
+    ValidateStateGL();
+    if (g_glState.framebuffer == framebuffer)
+    {
+        g_glState.filtered++;
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    g_glState.framebuffer = framebuffer;
+    g_glState.issued++;
+}
+
+// Deleting the bound framebuffer reverts the binding to 0
+void DeleteFramebufferGL(GLuint framebuffer)
+{
+    glDeleteFramebuffers(1, &framebuffer);
+    if (g_glState.valid && g_glState.framebuffer == framebuffer)
+    {
+        g_glState.framebuffer = 0;
+    }
+}
+
+void SetEnabledGL(GLenum cap, bool enabled)
+{
+    ValidateStateGL();
+    bool* cached = cap == GL_SCISSOR_TEST ? &g_glState.scissorTest
+                 : cap == GL_DEPTH_TEST ? &g_glState.depthTest
+                 : NULL;
+    if (cached && *cached == enabled)
+    {
+        g_glState.filtered++;
+        return;
+    }
+
+    if (enabled)
+    {
+        glEnable(cap);
+    }
+    else
+    {
+        glDisable(cap);
+    }
+    if (cached)
+    {
+        *cached = enabled;
+    }
+    g_glState.issued++;
+}
+
+void SetClearColorGL(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+{
+    ValidateStateGL();
+    GLfloat* cached = g_glState.clearColor;
+    if (cached[0] == r && cached[1] == g && cached[2] == b && cached[3] == a)
+    {
+        g_glState.filtered++;
+        return;
+    }
+
+    glClearColor(r, g, b, a);
+    cached[0] = r; cached[1] = g; cached[2] = b; cached[3] = a;
+    g_glState.issued++;
+}
+
+void SetScissorGL(GLint x, GLint y, GLsizei w, GLsizei h)
+{
+    ValidateStateGL();
+    GLint* cached = g_glState.scissor;
+    if (cached[0] == x && cached[1] == y && cached[2] == w && cached[3] == h)
+    {
+        g_glState.filtered++;
+        return;
+    }
+
+    glScissor(x, y, w, h);
+    cached[0] = x; cached[1] = y; cached[2] = w; cached[3] = h;
+    g_glState.issued++;
+}
+
+void SetViewportGL(GLint x, GLint y, GLsizei w, GLsizei h)
+{
+    ValidateStateGL();
+    GLint* cached = g_glState.viewport;
+    if (cached[0] == x && cached[1] == y && cached[2] == w && cached[3] == h)
+    {
+        g_glState.filtered++;
+        return;
+    }
+
+    glViewport(x, y, w, h);
+    cached[0] = x; cached[1] = y; cached[2] = w; cached[3] = h;
+    g_glState.issued++;
+}
+
+// Log a shader's compile errors, if there are any. Querying the status waits for the compile to finish.
+bool CheckShaderGL(GLuint shader)
+{
+    GLint compiled;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled)
+    {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        OutputDebugStringA(log);
+    }
+    return compiled != 0;
+}
+
+bool CheckProgramGL(GLuint program)
+{
+    GLint linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        OutputDebugStringA(log);
+    }
+    return linked != 0;
+}
+
+// A program built through the program cache, from a vertex and a fragment shader or from a compute shader.
+// The sources a program doesn't use are NULL.
+struct ProgramGL
+{
+    const char* name;
+    const char* vertexSource;
+    const char* fragmentSource;
+    const char* computeSource;
+    GLuint program;
+
+    // Set while the program is being built
+    UINT64 key;
+    GLuint shaders[2];
+    int shaderCount;
+};
+
+// Builds GL programs, caching their binaries in PROGRAM_CACHE_DIRECTORY so warm starts don't compile anything.
+// Binaries are keyed by a hash of the sources and the driver, and a binary the driver rejects is compiled and replaced.
+// Programs are requested first and finished together, so with GL_KHR_parallel_shader_compile the driver compiles them all at once.
+struct ProgramCacheGL
+{
+    char driverGL[256];
+    bool binariesSupported;
+    bool parallelCompile;
+
+    ProgramGL* pending[MAX_PENDING_PROGRAMS];
+    int pendingCount;
+
+    unsigned loaded;
+    unsigned compiled;
+    unsigned failed; // to compile or link
+    unsigned rejected;
+};
+
+static ProgramCacheGL g_programCache;
+
+// Written at the start of every cached binary
+struct ProgramBinaryHeader
+{
+    UINT32 magic;
+    UINT32 length;
+    UINT64 key;
+    GLenum format;
+};
+
+#define PROGRAM_BINARY_MAGIC 0x42505347 // "GSPB"
+
+bool HasExtensionGL(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void InitProgramCacheGL(ProgramCacheGL* cache, const char* driverGL)
+{
+    strncpy_s(cache->driverGL, driverGL, _TRUNCATE);
+
+    GLint binaryFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+    cache->binariesSupported = binaryFormats > 0 && glGetProgramBinary && glProgramBinary;
+    if (cache->binariesSupported && !CreateDirectoryA(PROGRAM_CACHE_DIRECTORY, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        OutputDebugStringA("Failed to create the program cache directory, not caching GL programs\n");
+        cache->binariesSupported = false;
+    }
+
+    // Let the driver use as many threads as it wants
+    cache->parallelCompile = glMaxShaderCompilerThreadsKHR &&
+        (HasExtensionGL("GL_KHR_parallel_shader_compile") || HasExtensionGL("GL_ARB_parallel_shader_compile"));
+    if (cache->parallelCompile)
+    {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    }
+
+    cache->pendingCount = 0;
+    cache->loaded = 0;
+    cache->compiled = 0;
+    cache->failed = 0;
+    cache->rejected = 0;
+}
+
+void GetProgramBinaryPath(const ProgramGL& program, char* path, size_t size)
+{
+    sprintf_s(path, size, "%s\\%016llx.bin", PROGRAM_CACHE_DIRECTORY, program.key);
+}
+
+// Returns false if there's no usable binary for the program
+bool LoadProgramBinaryGL(ProgramCacheGL* cache, ProgramGL* program)
+{
+    char path[MAX_PATH];
+    GetProgramBinaryPath(*program, path, sizeof(path));
+
+    FILE* f;
+    if (fopen_s(&f, path, "rb") != 0)
+    {
+        return false;
+    }
+
+    ProgramBinaryHeader header;
+    unsigned char* binary = NULL;
+    bool read = fread(&header, sizeof(header), 1, f) == 1 &&
+        header.magic == PROGRAM_BINARY_MAGIC && header.key == program->key;
+
+    // The length comes from the file, so a truncated or corrupt one mustn't be allocated or handed to GL as it is
+    if (read)
+    {
+        long binaryStart = ftell(f);
+        read = binaryStart >= 0 && fseek(f, 0, SEEK_END) == 0;
+        long fileSize = read ? ftell(f) : -1;
+        read = read && fileSize >= binaryStart && fseek(f, binaryStart, SEEK_SET) == 0 &&
+            header.length > 0 && header.length <= (UINT32)(fileSize - binaryStart) && header.length <= 0x7FFFFFFF;
+    }
+    if (read)
+    {
+        binary = new unsigned char[header.length];
+        read = fread(binary, 1, header.length, f) == header.length;
+    }
+    fclose(f);
+
+    bool linked = false;
+    if (read)
+    {
+        program->program = glCreateProgram();
+        glProgramBinary(program->program, header.format, binary, header.length);
+
+        // Drivers reject binaries from other driver versions, even when the renderer string didn't change
+        GLint status;
+        glGetProgramiv(program->program, GL_LINK_STATUS, &status);
+        linked = status != 0;
+        if (!linked)
+        {
+            glDeleteProgram(program->program);
+            program->program = 0;
+        }
+    }
+    delete[] binary;
+
+    if (!linked)
+    {
+        cache->rejected++;
+    }
+    return linked;
+}
+
+void SaveProgramBinaryGL(const ProgramGL& program)
+{
+    GLint length = 0;
+    glGetProgramiv(program.program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+    {
+        return;
+    }
+
+    ProgramBinaryHeader header;
+    header.magic = PROGRAM_BINARY_MAGIC;
+    header.key = program.key;
+    unsigned char* binary = new unsigned char[length];
+    GLsizei written = 0;
+    glGetProgramBinary(program.program, length, &written, &header.format, binary);
+    header.length = written;
+
+    char path[MAX_PATH];
+    GetProgramBinaryPath(program, path, sizeof(path));
+    FILE* f;
+    if (fopen_s(&f, path, "wb") == 0)
+    {
+        fwrite(&header, sizeof(header), 1, f);
+        fwrite(binary, 1, written, f);
+        fclose(f);
+    }
+    else
+    {
+        OutputDebugStringA("Failed to write a cached GL program\n");
+    }
+    delete[] binary;
+}
+
+// Load the program from the cache, or start compiling it. It's only usable after FinishProgramsGL.
+void RequestProgramGL(ProgramCacheGL* cache, ProgramGL* program)
+{
+    const char* sources[] = { program->vertexSource, program->fragmentSource, program->computeSource };
+    const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_COMPUTE_SHADER };
+    program->key = HashBytes(cache->driverGL, strlen(cache->driverGL));
+    for (int i = 0; i < (int)_countof(sources); i++)
+    {
+        if (sources[i])
+        {
+            program->key = HashBytes(&stages[i], sizeof(stages[i]), program->key);
+            program->key = HashBytes(sources[i], strlen(sources[i]), program->key);
+        }
+    }
+
+    if (cache->binariesSupported && LoadProgramBinaryGL(cache, program))
+    {
+        cache->loaded++;
+        return;
+    }
+
+    // Nothing is queried until every program is requested, so the compiles and links can overlap
+    program->program = glCreateProgram();
+    if (cache->binariesSupported)
+    {
+        glProgramParameteri(program->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    program->shaderCount = 0;
+    for (int i = 0; i < (int)_countof(sources); i++)
+    {
+        if (sources[i])
+        {
+            assert(program->shaderCount < (int)_countof(program->shaders));
+            GLuint shader = glCreateShader(stages[i]);
+            glShaderSource(shader, 1, &sources[i], NULL);
+            glCompileShader(shader);
+            glAttachShader(program->program, shader);
+            program->shaders[program->shaderCount++] = shader;
+        }
+    }
+    glLinkProgram(program->program);
+
+    assert(cache->pendingCount < MAX_PENDING_PROGRAMS);
+    cache->pending[cache->pendingCount++] = program;
+}
+
+// Check a program that finished compiling, and cache its binary if it linked
+void FinishProgramGL(ProgramCacheGL* cache, ProgramGL* program)
+{
+    bool compiled = true;
+    for (int s = 0; s < program->shaderCount; s++)
+    {
+        compiled &= CheckShaderGL(program->shaders[s]);
+    }
+    bool linked = compiled && CheckProgramGL(program->program);
+    if (linked && cache->binariesSupported)
+    {
+        SaveProgramBinaryGL(*program);
+    }
+    else if (!compiled)
+    {
+        char buf[128];
+        sprintf_s(buf, "Failed to compile the %s program\n", program->name);
+        OutputDebugStringA(buf);
+    }
+    for (int s = 0; s < program->shaderCount; s++)
+    {
+        glDeleteShader(program->shaders[s]);
+    }
+    if (linked)
+    {
+        cache->compiled++;
+    }
+    else
+    {
+        cache->failed++;
+    }
+}
+
+// Wait for the requested programs to compile, and cache the binaries of the ones that linked.
+// With parallel compiles, programs are finished in the order the driver completes them,
+// so checking and saving one overlaps with the others compiling instead of blocking on the first one requested.
+void FinishProgramsGL(ProgramCacheGL* cache)
+{
+    while (cache->pendingCount > 0)
+    {
+        int finished = 0;
+        for (int i = 0; i < cache->pendingCount; )
+        {
+            ProgramGL* program = cache->pending[i];
+            GLint completed = GL_TRUE;
+            if (cache->parallelCompile)
+            {
+                glGetProgramiv(program->program, GL_COMPLETION_STATUS_KHR, &completed);
+            }
+            if (completed)
+            {
+                FinishProgramGL(cache, program);
+                cache->pending[i] = cache->pending[--cache->pendingCount];
+                finished++;
+            }
+            else
+            {
+                i++;
+            }
+        }
+        if (finished == 0)
+        {
+            SwitchToThread();
+        }
+    }
+}
+
+ID3DBlob* CompileShaderD3D(const char* source, const char* entryPoint, const char* target)
+{
+    ID3DBlob* code;
+    ID3DBlob* errors;
+    HRESULT hr = D3DCompile(source, strlen(source), NULL, NULL, NULL, entryPoint, target, D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &code, &errors);
+    if (errors)
+    {
+        OutputDebugStringA((const char*)errors->GetBufferPointer());
+        errors->Release();
+    }
+    CheckHR(hr);
+    return code;
+}
+
+// A file mapped read-only, so reading it comes straight from the page cache
+struct MappedFile
+{
+    HANDLE file;
+    HANDLE mapping;
+    const unsigned char* data;
+    size_t size;
+};
+
+// Returns false if the file doesn't exist or can't be mapped, which includes empty files
+bool MapFileRead(const char* path, MappedFile* mapped)
+{
+    mapped->mapping = NULL;
+    mapped->data = NULL;
+    mapped->size = 0;
+    mapped->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mapped->file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(mapped->file, &size) && size.QuadPart > 0)
+    {
+        mapped->mapping = CreateFileMappingA(mapped->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    if (mapped->mapping)
+    {
+        mapped->data = (const unsigned char*)MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+        mapped->size = (size_t)size.QuadPart;
+    }
+    return mapped->data != NULL;
+}
+
+void UnmapFile(MappedFile* mapped)
+{
+    if (mapped->data)
+    {
+        UnmapViewOfFile(mapped->data);
+    }
+    if (mapped->mapping)
+    {
+        CloseHandle(mapped->mapping);
+    }
+    if (mapped->file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(mapped->file);
+    }
+    mapped->file = INVALID_HANDLE_VALUE;
+    mapped->mapping = NULL;
+    mapped->data = NULL;
+    mapped->size = 0;
+}
+
+// A pack file of precompiled DXBC: a header, an index sorted by key, then the bytecode of every entry
+struct ShaderPackHeader
+{
+    UINT32 magic;
+    UINT32 count;
+};
+
+struct ShaderPackEntry
+{
+    UINT64 key;
+    UINT32 offset; // from the start of the file
+    UINT32 size;
+};
+
+#define SHADER_PACK_MAGIC 0x4B504844 // "DHPK"
+
+// A pack that's been checked, pointing into its file's contents
+struct ShaderPack
+{
+    const unsigned char* data;
+    size_t size;
+    const ShaderPackEntry* entries;
+    UINT32 count;
+};
+
+// Check a pack's header and index against its size, so a truncated or corrupt file is treated like a missing one
+bool ParseShaderPack(const unsigned char* data, size_t size, ShaderPack* pack)
+{
+    memset(pack, 0, sizeof(*pack));
+
+    ShaderPackHeader header;
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != SHADER_PACK_MAGIC || header.count > (size - sizeof(header)) / sizeof(ShaderPackEntry))
+    {
+        return false;
+    }
+
+    const ShaderPackEntry* entries = (const ShaderPackEntry*)(data + sizeof(header));
+    for (UINT32 i = 0; i < header.count; i++)
+    {
+        if (entries[i].offset > size || entries[i].size > size - entries[i].offset ||
+            (i > 0 && entries[i].key <= entries[i - 1].key))
+        {
+            return false;
+        }
+    }
+
+    pack->data = data;
+    pack->size = size;
+    pack->entries = entries;
+    pack->count = header.count;
+    return true;
+}
+
+// Binary search of the index. Returns false if the pack doesn't have the key.
+bool FindShaderPackEntry(const ShaderPack& pack, UINT64 key, const void** code, size_t* size)
+{
+    UINT32 first = 0;
+    UINT32 last = pack.count;
+    while (first < last)
+    {
+        UINT32 middle = first + (last - first) / 2;
+        if (pack.entries[middle].key < key)
+        {
+            first = middle + 1;
+        }
+        else
+        {
+            last = middle;
+        }
+    }
+
+    if (first == pack.count || pack.entries[first].key != key)
+    {
+        return false;
+    }
+    *code = pack.data + pack.entries[first].offset;
+    *size = pack.entries[first].size;
+    return true;
+}
+
+// Bytecode to write into a pack
+struct ShaderPackBlob
+{
+    UINT64 key;
+    const void* code;
+    UINT32 size;
+};
+
+int CompareShaderPackBlobs(const void* a, const void* b)
+{
+    UINT64 keyA = ((const ShaderPackBlob*)a)->key;
+    UINT64 keyB = ((const ShaderPackBlob*)b)->key;
+    return keyA < keyB ? -1 : keyA > keyB ? 1 : 0;
+}
+
+// Write the blobs into a new pack. The blobs are sorted by key, and their keys must be unique.
+bool WriteShaderPack(const char* path, ShaderPackBlob* blobs, UINT32 count)
+{
+    qsort(blobs, count, sizeof(ShaderPackBlob), CompareShaderPackBlobs);
+
+    FILE* f;
+    if (fopen_s(&f, path, "wb") != 0)
+    {
+        return false;
+    }
+
+    ShaderPackHeader header;
+    header.magic = SHADER_PACK_MAGIC;
+    header.count = count;
+    fwrite(&header, sizeof(header), 1, f);
+
+    // Bytecode is kept 4-byte aligned
+    UINT32 offset = sizeof(header) + count * sizeof(ShaderPackEntry);
+    for (UINT32 i = 0; i < count; i++)
+    {
+        ShaderPackEntry entry;
+        entry.key = blobs[i].key;
+        entry.offset = offset;
+        entry.size = blobs[i].size;
+        fwrite(&entry, sizeof(entry), 1, f);
+        offset += (blobs[i].size + 3) & ~3u;
+    }
+
+    const unsigned char padding[3] = {};
+    for (UINT32 i = 0; i < count; i++)
+    {
+        fwrite(blobs[i].code, 1, blobs[i].size, f);
+        fwrite(padding, 1, ((blobs[i].size + 3) & ~3u) - blobs[i].size, f);
+    }
+
+    bool written = ferror(f) == 0;
+    fclose(f);
+    return written;
+}
+
+enum ShaderStateD3D
+{
+    SHADER_NOT_REQUESTED,
+    SHADER_PENDING,
+    SHADER_READY,
+};
+
+// A vertex or pixel shader, created by the shader loader the first time it's requested
+struct ShaderD3D
+{
+    const char* source;
+    const char* entryPoint;
+    const char* target; // vs_* or ps_*
+
+    std::atomic<int> state; // ShaderStateD3D
+    ID3D11DeviceChild* object; // only valid once the state is SHADER_READY
+};
+
+// Creates shaders on a worker thread, from the bytecode in SHADER_PACK_PATH.
+// Shaders missing from the pack are compiled instead, and written into a new pack by SaveShaderPackD3D.
+struct ShaderLoaderD3D
+{
+    ID3D11Device* device;
+
+    // The mapped pack. The worker holds the lock while it reads from the mapping, SaveShaderPackD3D while it replaces it.
+    SRWLOCK packLock;
+    MappedFile packFile;
+    ShaderPack pack;
+
+    // Requests the worker hasn't taken yet, and bytecode it compiled that isn't in the pack
+    SRWLOCK lock;
+    HANDLE requestsAvailable;
+    ShaderD3D* requests[MAX_SHADER_REQUESTS];
+    int requestCount;
+    int nextRequest;
+    ShaderPackBlob compiled[MAX_SHADER_REQUESTS];
+    ID3DBlob* compiledCode[MAX_SHADER_REQUESTS];
+    int compiledCount;
+
+    std::atomic<unsigned> loadedFromPack;
+    std::atomic<LONGLONG> waitTicks; // spent by passes waiting for a shader. The record workers add to it concurrently.
+};
+
+static ShaderLoaderD3D g_shaderLoader;
+
+UINT64 GetShaderKeyD3D(const ShaderD3D& shader)
+{
+    UINT64 key = HashBytes(shader.source, strlen(shader.source));
+    key = HashBytes(shader.entryPoint, strlen(shader.entryPoint), key);
+    return HashBytes(shader.target, strlen(shader.target), key);
+}
+
+void OpenShaderPackD3D(ShaderLoaderD3D* loader)
+{
+    if (!MapFileRead(SHADER_PACK_PATH, &loader->packFile) ||
+        !ParseShaderPack(loader->packFile.data, loader->packFile.size, &loader->pack))
+    {
+        OutputDebugStringA("Shader pack is missing or corrupt, compiling D3D shaders\n");
+    }
+}
+
+void CloseShaderPackD3D(ShaderLoaderD3D* loader)
+{
+    UnmapFile(&loader->packFile);
+    memset(&loader->pack, 0, sizeof(loader->pack));
+}
+
+void ShaderLoaderMain(ShaderLoaderD3D* loader)
+{
+    for (;;)
+    {
+        CheckWin32(WaitForSingleObject(loader->requestsAvailable, INFINITE) == WAIT_OBJECT_0);
+
+        AcquireSRWLockExclusive(&loader->lock);
+        ShaderD3D* shader = loader->requests[loader->nextRequest++];
+        ReleaseSRWLockExclusive(&loader->lock);
+
+        UINT64 key = GetShaderKeyD3D(*shader);
+        AcquireSRWLockShared(&loader->packLock);
+        const void* code;
+        size_t size;
+        ID3DBlob* compiledCode = NULL;
+        if (FindShaderPackEntry(loader->pack, key, &code, &size))
+        {
+            loader->loadedFromPack++;
+        }
+        else
+        {
+            compiledCode = CompileShaderD3D(shader->source, shader->entryPoint, shader->target);
+            code = compiledCode->GetBufferPointer();
+            size = compiledCode->GetBufferSize();
+        }
+
+        if (shader->target[0] == 'v')
+        {
+            CheckHR(loader->device->CreateVertexShader(code, size, NULL, (ID3D11VertexShader**)&shader->object));
+        }
+        else
+        {
+            CheckHR(loader->device->CreatePixelShader(code, size, NULL, (ID3D11PixelShader**)&shader->object));
+        }
+        CountComAlloc();
+        ReleaseSRWLockShared(&loader->packLock);
+
+        if (compiledCode)
+        {
+            AcquireSRWLockExclusive(&loader->lock);
+            int i = loader->compiledCount++;
+            loader->compiled[i].key = key;
+            loader->compiled[i].code = compiledCode->GetBufferPointer();
+            loader->compiled[i].size = (UINT32)compiledCode->GetBufferSize();
+            loader->compiledCode[i] = compiledCode;
+            ReleaseSRWLockExclusive(&loader->lock);
+        }
+
+        shader->state.store(SHADER_READY, std::memory_order_release);
+    }
+}
+
+// Map the pack and start the worker. The device must allow creating objects from other threads.
+void InitShaderLoaderD3D(ShaderLoaderD3D* loader, ID3D11Device* device)
+{
+    loader->device = device;
+    InitializeSRWLock(&loader->packLock);
+    InitializeSRWLock(&loader->lock);
+    loader->requestsAvailable = CreateSemaphore(NULL, 0, MAX_SHADER_REQUESTS, NULL);
+    CheckWin32(loader->requestsAvailable != NULL);
+    loader->requestCount = 0;
+    loader->nextRequest = 0;
+    loader->compiledCount = 0;
+    loader->loadedFromPack = 0;
+    loader->waitTicks = 0;
+    OpenShaderPackD3D(loader);
+
+    // Detached like the other workers, the process exits without joining them
+    std::thread(ShaderLoaderMain, loader).detach();
+}
+
+// Queue the shader for creation, unless it already is. Doesn't wait.
+void RequestShaderD3D(ShaderLoaderD3D* loader, ShaderD3D* shader)
+{
+    int expected = SHADER_NOT_REQUESTED;
+    if (!shader->state.compare_exchange_strong(expected, SHADER_PENDING))
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&loader->lock);
+    // Not an assert, since the request list would overflow in release builds
+    if (loader->requestCount == MAX_SHADER_REQUESTS)
+    {
+        CheckHR(E_OUTOFMEMORY);
+    }
+    loader->requests[loader->requestCount++] = shader;
+    ReleaseSRWLockExclusive(&loader->lock);
+    ReleaseSemaphore(loader->requestsAvailable, 1, NULL);
+}
+
+// Called by passes when they bind the shader. Only waits the first time, if the worker isn't done with it yet.
+ID3D11DeviceChild* WaitForShaderD3D(ShaderLoaderD3D* loader, ShaderD3D* shader)
+{
+    if (shader->state.load(std::memory_order_acquire) != SHADER_READY)
+    {
+        RequestShaderD3D(loader, shader);
+
+        LARGE_INTEGER waitStart;
+        QueryPerformanceCounter(&waitStart);
+        while (shader->state.load(std::memory_order_acquire) != SHADER_READY)
+        {
+            SwitchToThread();
+        }
+        LARGE_INTEGER waitEnd;
+        QueryPerformanceCounter(&waitEnd);
+        loader->waitTicks.fetch_add(waitEnd.QuadPart - waitStart.QuadPart, std::memory_order_relaxed);
+    }
+    return shader->object;
+}
+
+ID3D11VertexShader* GetVertexShaderD3D(ShaderLoaderD3D* loader, ShaderD3D* shader)
+{
+    assert(shader->target[0] == 'v');
+    return (ID3D11VertexShader*)WaitForShaderD3D(loader, shader);
+}
+
+ID3D11PixelShader* GetPixelShaderD3D(ShaderLoaderD3D* loader, ShaderD3D* shader)
+{
+    assert(shader->target[0] == 'p');
+    return (ID3D11PixelShader*)WaitForShaderD3D(loader, shader);
+}
+
+// Shaders compiled that aren't in the pack yet. The worker adds to them, so they're read under its lock.
+int GetCompiledShaderCountD3D(ShaderLoaderD3D* loader)
+{
+    AcquireSRWLockShared(&loader->lock);
+    int count = loader->compiledCount;
+    ReleaseSRWLockShared(&loader->lock);
+    return count;
+}
+
+// Write the shaders compiled so far into a new pack along with the old pack's, so the next start doesn't compile them
+void SaveShaderPackD3D(ShaderLoaderD3D* loader)
+{
+    AcquireSRWLockExclusive(&loader->packLock);
+    AcquireSRWLockExclusive(&loader->lock);
+    if (loader->compiledCount > 0)
+    {
+        UINT32 count = loader->pack.count + loader->compiledCount;
+        ShaderPackBlob* blobs = new ShaderPackBlob[count];
+        for (UINT32 i = 0; i < loader->pack.count; i++)
+        {
+            const ShaderPackEntry& entry = loader->pack.entries[i];
+            blobs[i].key = entry.key;
+            blobs[i].code = loader->pack.data + entry.offset;
+            blobs[i].size = entry.size;
+        }
+        memcpy(blobs + loader->pack.count, loader->compiled, loader->compiledCount * sizeof(ShaderPackBlob));
+
+        // The mapped pack can't be replaced, so the new one is written next to it first
+        char newPath[MAX_PATH];
+        sprintf_s(newPath, "%s.new", SHADER_PACK_PATH);
+        bool written = WriteShaderPack(newPath, blobs, count);
+        delete[] blobs;
+
+        CloseShaderPackD3D(loader);
+        if (written && MoveFileExA(newPath, SHADER_PACK_PATH, MOVEFILE_REPLACE_EXISTING))
+        {
+            char buf[128];
+            sprintf_s(buf, "Wrote %u D3D shaders to the shader pack\n", count);
+            OutputDebugStringA(buf);
+        }
+        else
+        {
+            OutputDebugStringA("Failed to write the shader pack\n");
+        }
+        OpenShaderPackD3D(loader);
+
+        for (int i = 0; i < loader->compiledCount; i++)
+        {
+            loader->compiledCode[i]->Release();
+        }
+        loader->compiledCount = 0;
+    }
+    ReleaseSRWLockExclusive(&loader->lock);
+    ReleaseSRWLockExclusive(&loader->packLock);
+}
+
+// A pack file of textures ready to be handed to CreateTexture2D: a header, an index of textures and their mips,
+// then every texture's mip chain, starting on a TEXTURE_PACK_ALIGNMENT boundary and laid out the way D3D expects
+// its initial data. Mapped, a texture is created straight from the page cache, without reading or copying it first.
+struct TexturePackHeader
+{
+    UINT32 magic;
+    UINT32 textureCount;
+    UINT32 mipCount; // of all textures
+    UINT32 alignment;
+};
+
+struct TexturePackTexture
+{
+    UINT64 nameHash;
+    UINT32 format; // DXGI_FORMAT
+    UINT32 width;
+    UINT32 height;
+    UINT32 firstMip; // into the mip index
+    UINT32 mipCount;
+    UINT32 padding;
+};
+
+struct TexturePackMip
+{
+    UINT64 offset; // from the start of the file
+    UINT32 rowPitch;
+    UINT32 size;
+};
+
+#define TEXTURE_PACK_MAGIC 0x4B505854 // "TXPK"
+
+// Mips within a chain start on this boundary
+#define TEXTURE_PACK_MIP_ALIGNMENT 16
+
+// Row pitch and row count of a mip in the layout D3D uses for initial data. Returns false for formats the pack doesn't support.
+bool GetSurfaceLayout(DXGI_FORMAT format, UINT width, UINT height, UINT* rowPitch, UINT* rowCount)
+{
+    UINT blockBytes = 0;
+    switch (format)
+    {
+    case DXGI_FORMAT_R8G8B8A8_UNORM:
+    case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+    case DXGI_FORMAT_B8G8R8A8_UNORM:
+    case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+        *rowPitch = width * 4;
+        *rowCount = height;
+        return true;
+    case DXGI_FORMAT_BC1_UNORM:
+    case DXGI_FORMAT_BC1_UNORM_SRGB:
+    case DXGI_FORMAT_BC4_UNORM:
+        blockBytes = 8;
+        break;
+    case DXGI_FORMAT_BC3_UNORM:
+    case DXGI_FORMAT_BC3_UNORM_SRGB:
+    case DXGI_FORMAT_BC5_UNORM:
+    case DXGI_FORMAT_BC7_UNORM:
+    case DXGI_FORMAT_BC7_UNORM_SRGB:
+        blockBytes = 16;
+        break;
+    default:
+        return false;
+    }
+
+    // Block compressed formats are stored in rows of 4x4 blocks
+    *rowPitch = ((width + 3) / 4 > 1 ? (width + 3) / 4 : 1) * blockBytes;
+    *rowCount = (height + 3) / 4 > 1 ? (height + 3) / 4 : 1;
+    return true;
+}
+
+// A pack that's been checked, pointing into its file's contents
+struct TexturePack
+{
+    const unsigned char* data;
+    size_t size;
+    const TexturePackTexture* textures;
+    UINT32 textureCount;
+    const TexturePackMip* mips;
+    UINT32 mipCount;
+};
+
+// Mips in a full chain down to 1x1, which is log2 of the larger side plus 1
+UINT32 FullMipCount(UINT32 width, UINT32 height)
+{
+    UINT32 largest = width > height ? width : height;
+    UINT32 count = 1;
+    while (largest > 1)
+    {
+        largest >>= 1;
+        count++;
+    }
+    return count;
+}
+
+// Check the index against the file's size and the formats' layouts, so loading never reads outside the file
+bool ParseTexturePack(const unsigned char* data, size_t size, TexturePack* pack)
+{
+    memset(pack, 0, sizeof(*pack));
+
+    TexturePackHeader header;
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    size_t indexSize = (size_t)header.textureCount * sizeof(TexturePackTexture) + (size_t)header.mipCount * sizeof(TexturePackMip);
+    if (header.magic != TEXTURE_PACK_MAGIC || header.textureCount > size || header.mipCount > size || indexSize > size - sizeof(header))
+    {
+        return false;
+    }
+
+    const TexturePackTexture* textures = (const TexturePackTexture*)(data + sizeof(header));
+    const TexturePackMip* mips = (const TexturePackMip*)(textures + header.textureCount);
+    for (UINT32 t = 0; t < header.textureCount; t++)
+    {
+        const TexturePackTexture& texture = textures[t];
+        if (texture.firstMip > header.mipCount || texture.mipCount > header.mipCount - texture.firstMip || texture.mipCount == 0)
+        {
+            return false;
+        }
+        // D3D can't create an empty texture or more mips than the chain has, and CreateTextureFromPackD3D has room for D3D11_REQ_MIP_LEVELS
+        if (texture.width == 0 || texture.height == 0 ||
+            texture.mipCount > D3D11_REQ_MIP_LEVELS || texture.mipCount > FullMipCount(texture.width, texture.height))
+        {
+            return false;
+        }
+        for (UINT32 m = 0; m < texture.mipCount; m++)
+        {
+            const TexturePackMip& mip = mips[texture.firstMip + m];
+            UINT width = texture.width >> m > 1 ? texture.width >> m : 1;
+            UINT height = texture.height >> m > 1 ? texture.height >> m : 1;
+            UINT rowPitch, rowCount;
+            if (!GetSurfaceLayout((DXGI_FORMAT)texture.format, width, height, &rowPitch, &rowCount) ||
+                mip.rowPitch != rowPitch || mip.size != (UINT64)rowPitch * rowCount ||
+                mip.offset > size || mip.size > size - mip.offset)
+            {
+                return false;
+            }
+        }
+    }
+
+    pack->data = data;
+    pack->size = size;
+    pack->textures = textures;
+    pack->textureCount = header.textureCount;
+    pack->mips = mips;
+    pack->mipCount = header.mipCount;
+    return true;
+}
+
+// Create a texture with its whole mip chain, reading the texels straight out of the pack
+HRESULT CreateTextureFromPackD3D(ID3D11Device* device, const TexturePack& pack, UINT32 index, ID3D11Texture2D** texture)
+{
+    assert(index < pack.textureCount);
+    const TexturePackTexture& entry = pack.textures[index];
+
+    D3D11_SUBRESOURCE_DATA initialData[D3D11_REQ_MIP_LEVELS];
+    assert(entry.mipCount <= D3D11_REQ_MIP_LEVELS);
+    for (UINT32 m = 0; m < entry.mipCount; m++)
+    {
+        const TexturePackMip& mip = pack.mips[entry.firstMip + m];
+        initialData[m].pSysMem = pack.data + mip.offset;
+        initialData[m].SysMemPitch = mip.rowPitch;
+        initialData[m].SysMemSlicePitch = mip.size;
+    }
+
+    CD3D11_TEXTURE2D_DESC desc((DXGI_FORMAT)entry.format, entry.width, entry.height, 1, entry.mipCount, D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_IMMUTABLE);
+    return device->CreateTexture2D(&desc, initialData, texture);
+}
+
+// A texture to write into a pack, with every mip laid out as GetSurfaceLayout says
+struct TexturePackSource
+{
+    UINT64 nameHash;
+    DXGI_FORMAT format;
+    UINT width;
+    UINT height;
+    UINT mipCount;
+    const void* mips[D3D11_REQ_MIP_LEVELS];
+};
+
+bool WriteTexturePack(const char* path, const TexturePackSource* sources, UINT32 count)
+{
+    TexturePackHeader header;
+    header.magic = TEXTURE_PACK_MAGIC;
+    header.textureCount = count;
+    header.mipCount = 0;
+    header.alignment = TEXTURE_PACK_ALIGNMENT;
+    for (UINT32 t = 0; t < count; t++)
+    {
+        header.mipCount += sources[t].mipCount;
+    }
+
+    // Lay out the index first, so the data's offsets are known before anything is written
+    TexturePackTexture* textures = new TexturePackTexture[count];
+    TexturePackMip* mips = new TexturePackMip[header.mipCount];
+    UINT64 offset = sizeof(header) + count * sizeof(TexturePackTexture) + header.mipCount * sizeof(TexturePackMip);
+    UINT32 mipIndex = 0;
+    for (UINT32 t = 0; t < count; t++)
+    {
+        const TexturePackSource& source = sources[t];
+        textures[t].nameHash = source.nameHash;
+        textures[t].format = source.format;
+        textures[t].width = source.width;
+        textures[t].height = source.height;
+        textures[t].firstMip = mipIndex;
+        textures[t].mipCount = source.mipCount;
+        textures[t].padding = 0;
+
+        offset = (offset + TEXTURE_PACK_ALIGNMENT - 1) & ~(UINT64)(TEXTURE_PACK_ALIGNMENT - 1);
+        for (UINT m = 0; m < source.mipCount; m++)
+        {
+            UINT width = source.width >> m > 1 ? source.width >> m : 1;
+            UINT height = source.height >> m > 1 ? source.height >> m : 1;
+            UINT rowPitch, rowCount;
+            CheckHR(GetSurfaceLayout(source.format, width, height, &rowPitch, &rowCount) ? S_OK : E_INVALIDARG);
+
+            offset = (offset + TEXTURE_PACK_MIP_ALIGNMENT - 1) & ~(UINT64)(TEXTURE_PACK_MIP_ALIGNMENT - 1);
+            mips[mipIndex].offset = offset;
+            mips[mipIndex].rowPitch = rowPitch;
+            mips[mipIndex].size = rowPitch * rowCount;
+            offset += mips[mipIndex].size;
+            mipIndex++;
+        }
+    }
+
+    bool written = false;
+    FILE* f;
+    if (fopen_s(&f, path, "wb") == 0)
+    {
+        fwrite(&header, sizeof(header), 1, f);
+        fwrite(textures, sizeof(TexturePackTexture), count, f);
+        fwrite(mips, sizeof(TexturePackMip), header.mipCount, f);
+
+        // Zeros up to each mip's offset
+        static const unsigned char padding[TEXTURE_PACK_ALIGNMENT] = {};
+        UINT64 position = sizeof(header) + count * sizeof(TexturePackTexture) + header.mipCount * sizeof(TexturePackMip);
+        mipIndex = 0;
+        for (UINT32 t = 0; t < count; t++)
+        {
+            for (UINT m = 0; m < sources[t].mipCount; m++)
+            {
+                const TexturePackMip& mip = mips[mipIndex++];
+                fwrite(padding, 1, (size_t)(mip.offset - position), f);
+                fwrite(sources[t].mips[m], 1, mip.size, f);
+                position = mip.offset + mip.size;
+            }
+        }
+
+        written = ferror(f) == 0;
+        fclose(f);
+    }
+
+    delete[] textures;
+    delete[] mips;
+    return written;
+}
+
+// Builds a pack of TEXTURE_PACK_BENCHMARK_TEXTURES generated RGBA8 textures with full mip chains, if there isn't one yet.
+// Each mip is a box filter of the one above it.
+void BuildBenchmarkTexturePack()
+{
+    MappedFile existing;
+    TexturePack pack;
+    bool valid = MapFileRead(TEXTURE_PACK_PATH, &existing) && ParseTexturePack(existing.data, existing.size, &pack) &&
+        pack.textureCount == TEXTURE_PACK_BENCHMARK_TEXTURES;
+    UnmapFile(&existing);
+    if (valid)
+    {
+        return;
+    }
+
+    TexturePackSource sources[TEXTURE_PACK_BENCHMARK_TEXTURES];
+    for (UINT32 t = 0; t < TEXTURE_PACK_BENCHMARK_TEXTURES; t++)
+    {
+        TexturePackSource& source = sources[t];
+        source.nameHash = HashBytes(&t, sizeof(t));
+        source.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        source.width = TEXTURE_PACK_BENCHMARK_SIZE;
+        source.height = TEXTURE_PACK_BENCHMARK_SIZE;
+        source.mipCount = 0;
+        for (UINT size = TEXTURE_PACK_BENCHMARK_SIZE; size > 0; size /= 2)
+        {
+            UINT32* texels = new UINT32[size * size];
+            if (size == TEXTURE_PACK_BENCHMARK_SIZE)
+            {
+                for (UINT y = 0; y < size; y++)
+                {
+                    for (UINT x = 0; x < size; x++)
+                    {
+                        texels[y * size + x] = 0xFF000000 | ((x * 255 / size) << 16) | ((y * 255 / size) << 8) | ((t * 37) & 0xFF);
+                    }
+                }
+            }
+            else
+            {
+                const unsigned char* above = (const unsigned char*)source.mips[source.mipCount - 1];
+                unsigned char* below = (unsigned char*)texels;
+                UINT aboveSize = size * 2;
+                for (UINT y = 0; y < size; y++)
+                {
+                    for (UINT x = 0; x < size; x++)
+                    {
+                        for (UINT c = 0; c < 4; c++)
+                        {
+                            UINT sum = above[((2 * y) * aboveSize + 2 * x) * 4 + c] + above[((2 * y) * aboveSize + 2 * x + 1) * 4 + c] +
+                                above[((2 * y + 1) * aboveSize + 2 * x) * 4 + c] + above[((2 * y + 1) * aboveSize + 2 * x + 1) * 4 + c];
+                            below[(y * size + x) * 4 + c] = (unsigned char)(sum / 4);
+                        }
+                    }
+                }
+            }
+            source.mips[source.mipCount++] = texels;
+        }
+    }
+
+    if (!WriteTexturePack(TEXTURE_PACK_PATH, sources, TEXTURE_PACK_BENCHMARK_TEXTURES))
+    {
+        OutputDebugStringA("Failed to write the texture pack\n");
+    }
+
+    for (UINT32 t = 0; t < TEXTURE_PACK_BENCHMARK_TEXTURES; t++)
+    {
+        for (UINT m = 0; m < sources[t].mipCount; m++)
+        {
+            delete[] (const UINT32*)sources[t].mips[m];
+        }
+    }
+}
+
+// Create every texture of the pack, mapped vs. read into memory with fread first, and compare their throughput.
+// Both run once untimed first, so both read from a warm page cache.
+void BenchmarkTexturePack(ID3D11Device* device)
+{
+    BuildBenchmarkTexturePack();
+
+    double mappedMs = 0.0;
+    double readMs = 0.0;
+    UINT64 bytes = 0;
+    for (int iteration = 0; iteration <= TEXTURE_PACK_BENCHMARK_ITERATIONS; iteration++)
+    {
+        LARGE_INTEGER mappedStart;
+        QueryPerformanceCounter(&mappedStart);
+        MappedFile mapped;
+        TexturePack pack;
+        if (!MapFileRead(TEXTURE_PACK_PATH, &mapped) || !ParseTexturePack(mapped.data, mapped.size, &pack))
+        {
+            OutputDebugStringA("Texture pack is missing or corrupt\n");
+            UnmapFile(&mapped);
+            return;
+        }
+        for (UINT32 t = 0; t < pack.textureCount; t++)
+        {
+            ID3D11Texture2D* texture;
+            CheckHR(CreateTextureFromPackD3D(device, pack, t, &texture));
+            texture->Release();
+        }
+        UnmapFile(&mapped);
+        LARGE_INTEGER mappedEnd;
+        QueryPerformanceCounter(&mappedEnd);
+
+        // The conventional path: read the whole file into memory, then create the textures from the copy
+        LARGE_INTEGER readStart;
+        QueryPerformanceCounter(&readStart);
+        FILE* f;
+        CheckHR(fopen_s(&f, TEXTURE_PACK_PATH, "rb") == 0 ? S_OK : E_FAIL);
+        fseek(f, 0, SEEK_END);
+        size_t size = (size_t)ftell(f);
+        fseek(f, 0, SEEK_SET);
+        unsigned char* contents = new unsigned char[size];
+        size_t read = fread(contents, 1, size, f);
+        fclose(f);
+        CheckHR(read == size && ParseTexturePack(contents, size, &pack) ? S_OK : E_FAIL);
+        for (UINT32 t = 0; t < pack.textureCount; t++)
+        {
+            ID3D11Texture2D* texture;
+            CheckHR(CreateTextureFromPackD3D(device, pack, t, &texture));
+            texture->Release();
+        }
+        delete[] contents;
+        LARGE_INTEGER readEnd;
+        QueryPerformanceCounter(&readEnd);
+
+        if (iteration > 0)
+        {
+            mappedMs += ElapsedMs(mappedStart, mappedEnd);
+            readMs += ElapsedMs(readStart, readEnd);
+        }
+        bytes = size;
+    }
+
+    double megabytes = (double)bytes * TEXTURE_PACK_BENCHMARK_ITERATIONS / (1024.0 * 1024.0);
+    char buf[256];
+    sprintf_s(buf, "Texture pack (%.1f MB): mapped %.0f MB/s, read into memory %.0f MB/s\n",
+        bytes / (1024.0 * 1024.0),
+        megabytes / (mappedMs / 1000.0),
+        megabytes / (readMs / 1000.0));
+    OutputDebugStringA(buf);
+}
+
+// Which API draws a quad of the depth scene, and when.
+// D3D clears depth, then draws before and after GL, so depth written by each API is tested by the other.
+enum DepthScenePass
+{
+    DEPTH_SCENE_D3D_BEFORE_GL,
+    DEPTH_SCENE_GL,
+    DEPTH_SCENE_D3D_AFTER_GL,
+};
+
+struct DepthSceneQuad
+{
+    DepthScenePass pass;
+    float rect[4]; // x0, y0, x1, y1 in normalized device coordinates
+    float depth;   // window depth, the same in both APIs
+    float color[4];
+};
+
+static const DepthSceneQuad g_depthSceneQuads[] = {
+    { DEPTH_SCENE_D3D_BEFORE_GL, { -0.5f, -0.5f, 0.5f, 0.5f }, 0.5f, { 1.0f, 0.0f, 0.0f, 1.0f } },
+    { DEPTH_SCENE_GL, { -0.75f, -0.25f, 0.0f, 0.25f }, 0.25f, { 0.0f, 1.0f, 0.0f, 1.0f } },
+    { DEPTH_SCENE_GL, { 0.0f, -0.25f, 0.75f, 0.25f }, 0.75f, { 0.0f, 0.0f, 1.0f, 1.0f } },
+    { DEPTH_SCENE_D3D_AFTER_GL, { -0.25f, -0.75f, 0.25f, 0.75f }, 0.375f, { 1.0f, 1.0f, 0.0f, 1.0f } },
+};
+
+// Pixels with a known result if depth is shared correctly, in normalized device coordinates.
+// They're symmetric around y = 0, so they don't depend on GL seeing the shared buffers upside down.
+struct DepthSceneSample
+{
+    float x, y;
+    float color[4];
+};
+
+static const DepthSceneSample g_depthSceneSamples[] = {
+    { -0.375f, 0.0f, { 0.0f, 1.0f, 0.0f, 1.0f } },  // GL in front of D3D
+    { -0.125f, 0.0f, { 0.0f, 1.0f, 0.0f, 1.0f } },  // D3D hidden by depth GL wrote
+    { 0.125f, 0.0f, { 1.0f, 1.0f, 0.0f, 1.0f } },   // D3D in front of GL
+    { 0.375f, 0.0f, { 1.0f, 0.0f, 0.0f, 1.0f } },   // GL hidden by depth D3D wrote
+    { 0.625f, 0.0f, { 0.0f, 0.0f, 1.0f, 1.0f } },   // GL in front of the depth D3D cleared
+    { 0.0f, 0.625f, { 1.0f, 1.0f, 0.0f, 1.0f } },
+    { 0.0f, -0.625f, { 1.0f, 1.0f, 0.0f, 1.0f } },
+    { 0.875f, 0.875f, { 0.0f, 0.0f, 0.0f, 1.0f } }, // nothing drawn
+};
+
+// Both APIs draw the quads from the vertex ID, so there's no vertex buffer to share
+static const char* g_depthSceneHLSL =
+    "cbuffer Quad : register(b0) { float4 rect; float4 color; float depth; };\n"
+    "float4 vs_main(uint id : SV_VertexID) : SV_Position {\n"
+    "    float2 uv = float2(id & 1, id >> 1);\n"
+    "    return float4(lerp(rect.xy, rect.zw, uv), depth, 1.0);\n"
+    "}\n"
+    "float4 ps_main() : SV_Target { return color; }\n";
+
+static const char* g_depthSceneVertexGLSL =
+    "#version 430\n"
+    "uniform vec4 rect;\n"
+    "uniform float depth;\n"
+    "void main() {\n"
+    "    vec2 uv = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "    gl_Position = vec4(mix(rect.xy, rect.zw, uv), depth * 2.0 - 1.0, 1.0);\n"
+    "}\n";
+
+static const char* g_depthSceneFragmentGLSL =
+    "#version 430\n"
+    "uniform vec4 color;\n"
+    "out vec4 fragColor;\n"
+    "void main() { fragColor = color; }\n";
+
+static ProgramGL g_depthSceneProgramGL = { "depth scene", g_depthSceneVertexGLSL, g_depthSceneFragmentGLSL };
+
+struct DepthSceneConstants
+{
+    float rect[4];
+    float color[4];
+    float depth;
+    float padding[3];
+};
+
+static ShaderD3D g_depthSceneVertexShaderD3D = { g_depthSceneHLSL, "vs_main", "vs_5_0" };
+static ShaderD3D g_depthScenePixelShaderD3D = { g_depthSceneHLSL, "ps_main", "ps_5_0" };
+
+struct DepthScene
+{
+    ShaderD3D* vertexShader;
+    ShaderD3D* pixelShader;
+    ID3D11Buffer* constants;
+    ID3D11RasterizerState* rasterizerState;
+    ID3D11DepthStencilState* depthStencilState;
+
+    GLuint programGL;
+    GLuint vertexArrayGL;
+    GLint rectLocationGL;
+    GLint depthLocationGL;
+    GLint colorLocationGL;
+};
+
+void InitDepthScene(DepthScene* scene, ID3D11Device* device)
+{
+    // Created on the shader loader's thread while the rest is set up, the first draw waits for them if needed
+    scene->vertexShader = &g_depthSceneVertexShaderD3D;
+    scene->pixelShader = &g_depthScenePixelShaderD3D;
+    RequestShaderD3D(&g_shaderLoader, scene->vertexShader);
+    RequestShaderD3D(&g_shaderLoader, scene->pixelShader);
+
+    CheckHR(device->CreateBuffer(&CD3D11_BUFFER_DESC(sizeof(DepthSceneConstants), D3D11_BIND_CONSTANT_BUFFER), NULL, &scene->constants));
+
+    // The quads are wound counter-clockwise for GL, so D3D doesn't cull
+    CD3D11_RASTERIZER_DESC rasterizerDesc(D3D11_DEFAULT);
+    rasterizerDesc.CullMode = D3D11_CULL_NONE;
+    scene->rasterizerState = GetRasterizerState(&g_stateObjects, device, rasterizerDesc);
+    scene->depthStencilState = GetDepthStencilState(&g_stateObjects, device, CD3D11_DEPTH_STENCIL_DESC(D3D11_DEFAULT));
+
+    scene->programGL = g_depthSceneProgramGL.program;
+    scene->rectLocationGL = glGetUniformLocation(scene->programGL, "rect");
+    scene->depthLocationGL = glGetUniformLocation(scene->programGL, "depth");
+    scene->colorLocationGL = glGetUniformLocation(scene->programGL, "color");
+
+    // Core profiles can't draw without a vertex array, even an empty one
+    glGenVertexArrays(1, &scene->vertexArrayGL);
+}
+
+// Draw the quads of one pass into the bound render targets. D3D passes bind their pipeline through the tracker.
+void DrawDepthScene(const DepthScene& scene, DepthScenePass pass, D3DStateTracker* tracker)
+{
+    if (pass == DEPTH_SCENE_GL)
+    {
+        SetEnabledGL(GL_SCISSOR_TEST, false);
+        SetEnabledGL(GL_DEPTH_TEST, true);
+        glUseProgram(scene.programGL);
+        glBindVertexArray(scene.vertexArrayGL);
+    }
+    else
+    {
+        ID3D11DeviceContext* context = tracker->context;
+        context->IASetInputLayout(NULL);
+        context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+        context->VSSetShader(GetVertexShaderD3D(&g_shaderLoader, scene.vertexShader), NULL, 0);
+        context->VSSetConstantBuffers(0, 1, &scene.constants);
+        context->PSSetShader(GetPixelShaderD3D(&g_shaderLoader, scene.pixelShader), NULL, 0);
+        context->PSSetConstantBuffers(0, 1, &scene.constants);
+        SetRasterizerStateD3D(tracker, scene.rasterizerState);
+        SetDepthStencilStateD3D(tracker, scene.depthStencilState, 0);
+    }
+
+    for (int i = 0; i < (int)_countof(g_depthSceneQuads); i++)
+    {
+        const DepthSceneQuad& quad = g_depthSceneQuads[i];
+        if (quad.pass != pass)
+        {
+            continue;
+        }
+
+        if (pass == DEPTH_SCENE_GL)
+        {
+            glUniform4fv(scene.rectLocationGL, 1, quad.rect);
+            glUniform1f(scene.depthLocationGL, quad.depth);
+            glUniform4fv(scene.colorLocationGL, 1, quad.color);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+        else
+        {
+            DepthSceneConstants constants = {};
+            memcpy(constants.rect, quad.rect, sizeof(constants.rect));
+            memcpy(constants.color, quad.color, sizeof(constants.color));
+            constants.depth = quad.depth;
+            tracker->context->UpdateSubresource(scene.constants, 0, NULL, &constants, 0, 0);
+            tracker->context->Draw(4, 0);
+        }
+    }
+}
+
+// Each object is a grid of small quads, one per instance, inside its own cell of the screen
+static const char* g_benchmarkHLSL =
+    "cbuffer Object : register(b0) { float4 placement; float4 color; };\n"
+    "float4 vs_main(uint vertexId : SV_VertexID, uint instanceId : SV_InstanceID) : SV_Position {\n"
+    "    uint perRow = (uint)placement.w;\n"
+    "    float size = placement.z / perRow;\n"
+    "    float2 uv = float2(vertexId & 1, vertexId >> 1) * 0.8;\n"
+    "    float2 cell = float2(instanceId % perRow, instanceId / perRow);\n"
+    "    return float4(placement.xy + (cell + uv) * size, 0.5, 1.0);\n"
+    "}\n"
+    "float4 ps_main() : SV_Target { return color; }\n";
+
+static const char* g_benchmarkVertexGLSL =
+    "#version 430\n"
+    "uniform vec4 placement;\n"
+    "void main() {\n"
+    "    int perRow = int(placement.w);\n"
+    "    float size = placement.z / perRow;\n"
+    "    vec2 uv = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 0.8;\n"
+    "    vec2 cell = vec2(gl_InstanceID % perRow, gl_InstanceID / perRow);\n"
+    "    gl_Position = vec4(placement.xy + (cell + uv) * size, 0.0, 1.0);\n"
+    "}\n";
+
+static const char* g_benchmarkFragmentGLSL =
+    "#version 430\n"
+    "uniform vec4 color;\n"
+    "out vec4 fragColor;\n"
+    "void main() { fragColor = color; }\n";
+
+static ProgramGL g_benchmarkProgramGL = { "benchmark", g_benchmarkVertexGLSL, g_benchmarkFragmentGLSL };
+
+// Per-draw constants, the same layout in both APIs
+struct BenchmarkObject
+{
+    float placement[4]; // x, y of the cell's corner, cell size, instances per row
+    float color[4];
+};
+
+// glMultiDrawElementsIndirect's command layout
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLuint baseVertex;
+    GLuint baseInstance;
+};
+
+// Draws many instanced objects per GL call. Each frame's draw commands and per-draw objects are written into
+// persistently mapped buffers, and the shader finds its object through a per-draw index attribute:
+// with the divisor set to the instance count, baseInstance selects the attribute element, so no
+// GL 4.6 gl_DrawID is needed.
+struct BatchRendererGL
+{
+    int capacity; // draws per frame
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint indexBuffer;
+    GLuint drawIndexBuffer;
+    GLuint commandBuffer;
+    GLuint objectBuffer;
+
+    DrawElementsIndirectCommand* commands;
+    unsigned char* objects;
+    GLsizeiptr objectRegionSize; // padded to the SSBO offset alignment
+    GLsync fences[BATCH_BUFFERED_FRAMES];
+    int region;
+    int drawCount;
+
+    // Since the last report
+    unsigned builtDraws;
+    LONGLONG buildTicks;
+    unsigned fenceWaits;
+    unsigned multiDrawCalls;
+};
+
+static const char* g_batchVertexGLSL =
+    "#version 430\n"
+    "layout(location = 0) in int drawIndex;\n"
+    "struct Object { vec4 placement; vec4 color; };\n"
+    "layout(std430, binding = 0) readonly buffer Objects { Object objects[]; };\n"
+    "flat out vec4 objectColor;\n"
+    "void main() {\n"
+    "    Object object = objects[drawIndex];\n"
+    "    int perRow = int(object.placement.w);\n"
+    "    float size = object.placement.z / perRow;\n"
+    "    vec2 uv = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 0.8;\n"
+    "    vec2 cell = vec2(gl_InstanceID % perRow, gl_InstanceID / perRow);\n"
+    "    gl_Position = vec4(object.placement.xy + (cell + uv) * size, 0.0, 1.0);\n"
+    "    objectColor = object.color;\n"
+    "}\n";
+
+static const char* g_batchFragmentGLSL =
+    "#version 430\n"
+    "flat in vec4 objectColor;\n"
+    "out vec4 fragColor;\n"
+    "void main() { fragColor = objectColor; }\n";
+
+static ProgramGL g_batchProgramGL = { "batch", g_batchVertexGLSL, g_batchFragmentGLSL };
+
+// Returns false if the driver can't persistently map buffers
+bool InitBatchRendererGL(BatchRendererGL* batch, int capacity)
+{
+    if (!glBufferStorage || !glMultiDrawElementsIndirect)
+    {
+        OutputDebugStringA("Persistently mapped buffers aren't supported, not batching GL draws\n");
+        return false;
+    }
+
+    batch->capacity = capacity;
+
+    batch->program = g_batchProgramGL.program;
+
+    glGenVertexArrays(1, &batch->vertexArray);
+    glBindVertexArray(batch->vertexArray);
+
+    // A quad, with positions made from the vertex index
+    const GLushort indices[] = { 0, 1, 2, 2, 1, 3 };
+    glGenBuffers(1, &batch->indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->indexBuffer);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, 0);
+
+    GLint* drawIndices = new GLint[capacity];
+    for (int i = 0; i < capacity; i++)
+    {
+        drawIndices[i] = i;
+    }
+    glGenBuffers(1, &batch->drawIndexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, batch->drawIndexBuffer);
+    glBufferStorage(GL_ARRAY_BUFFER, capacity * sizeof(GLint), drawIndices, 0);
+    delete[] drawIndices;
+    glVertexAttribIPointer(0, 1, GL_INT, sizeof(GLint), NULL);
+    glVertexAttribDivisor(0, BENCHMARK_INSTANCES_PER_OBJECT);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+
+    GLbitfield mapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    GLsizeiptr commandRegionSize = capacity * sizeof(DrawElementsIndirectCommand);
+    glGenBuffers(1, &batch->commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch->commandBuffer);
+    glBufferStorage(GL_DRAW_INDIRECT_BUFFER, commandRegionSize * BATCH_BUFFERED_FRAMES, NULL, mapFlags);
+    batch->commands = (DrawElementsIndirectCommand*)glMapBufferRange(GL_DRAW_INDIRECT_BUFFER, 0, commandRegionSize * BATCH_BUFFERED_FRAMES, mapFlags);
+
+    GLint alignment;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    batch->objectRegionSize = (capacity * sizeof(BenchmarkObject) + alignment - 1) / alignment * alignment;
+    glGenBuffers(1, &batch->objectBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch->objectBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, batch->objectRegionSize * BATCH_BUFFERED_FRAMES, NULL, mapFlags);
+    batch->objects = (unsigned char*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, batch->objectRegionSize * BATCH_BUFFERED_FRAMES, mapFlags);
+
+    return batch->commands != NULL && batch->objects != NULL;
+}
+
+// Move on to the next region, once the GPU is done reading it
+void BeginBatchGL(BatchRendererGL* batch)
+{
+    batch->region = (batch->region + 1) % BATCH_BUFFERED_FRAMES;
+    GLsync fence = batch->fences[batch->region];
+    if (fence)
+    {
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        {
+            batch->fenceWaits++;
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+            {
+            }
+        }
+        glDeleteSync(fence);
+        batch->fences[batch->region] = NULL;
+    }
+}
+
+// Write draws [first, last) of the current region. Disjoint ranges can be filled from different threads.
+void FillBatchGL(BatchRendererGL* batch, const BenchmarkObject* objects, int first, int last)
+{
+    assert(last <= batch->capacity);
+
+    DrawElementsIndirectCommand* commands = batch->commands + batch->region * batch->capacity;
+    for (int i = first; i < last; i++)
+    {
+        commands[i].count = 6;
+        commands[i].instanceCount = BENCHMARK_INSTANCES_PER_OBJECT;
+        commands[i].firstIndex = 0;
+        commands[i].baseVertex = 0;
+        commands[i].baseInstance = i;
+    }
+    memcpy(batch->objects + batch->region * batch->objectRegionSize + first * sizeof(BenchmarkObject), objects + first, (last - first) * sizeof(BenchmarkObject));
+}
+
+// Write the frame's draws into the next region
+void BuildBatchGL(BatchRendererGL* batch, const BenchmarkObject* objects, int count)
+{
+    LARGE_INTEGER buildStart;
+    QueryPerformanceCounter(&buildStart);
+
+    BeginBatchGL(batch);
+    FillBatchGL(batch, objects, 0, count);
+    batch->drawCount = count;
+
+    LARGE_INTEGER buildEnd;
+    QueryPerformanceCounter(&buildEnd);
+    batch->builtDraws += count;
+    batch->buildTicks += buildEnd.QuadPart - buildStart.QuadPart;
+}
+
+// Draw part of the frame's batch with one call
+void DrawBatchGL(BatchRendererGL* batch, int first, int last)
+{
+    glUseProgram(batch->program);
+    glBindVertexArray(batch->vertexArray);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch->commandBuffer);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, batch->objectBuffer, batch->region * batch->objectRegionSize, batch->objectRegionSize);
+
+    GLintptr commandOffset = (batch->region * batch->capacity + first) * sizeof(DrawElementsIndirectCommand);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, (const void*)commandOffset, last - first, 0);
+    batch->multiDrawCalls++;
+}
+
+// Fence the frame's region, after the last draw that reads it
+void EndBatchGL(BatchRendererGL* batch)
+{
+    batch->fences[batch->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static ShaderD3D g_benchmarkVertexShaderD3D = { g_benchmarkHLSL, "vs_main", "vs_5_0" };
+static ShaderD3D g_benchmarkPixelShaderD3D = { g_benchmarkHLSL, "ps_main", "ps_5_0" };
+
+struct BenchmarkScene
+{
+    // The first d3dObjectCount objects are drawn by D3D, the rest by GL
+    BenchmarkObject objects[BENCHMARK_OBJECT_COUNT];
+    int d3dObjectCount;
+
+    ShaderD3D* vertexShader;
+    ShaderD3D* pixelShader;
+    ID3D11Buffer* constants;
+    ID3D11RasterizerState* rasterizerState;
+    ID3D11DepthStencilState* depthStencilState;
+
+    GLuint programGL;
+    GLuint vertexArrayGL;
+    GLint placementLocationGL;
+    GLint colorLocationGL;
+
+    bool useBatchGL;
+    BatchRendererGL batchGL;
+
+    // Where each object's placement is centered as it's animated
+    float homes[BENCHMARK_OBJECT_COUNT][2];
+
+    // The objects each API draws between handoffs, BENCHMARK_API_SWITCHES per API, from the frame arena
+    DrawRecord* d3dChunks;
+    DrawRecord* glChunks;
+
+    // Since the last report
+    unsigned drawCalls;
+    unsigned apiSwitches;
+    LONGLONG apiSwitchTicks;
+    LONGLONG cpuStageTicks;
+};
+
+static BenchmarkScene g_benchmarkScene;
+
+void InitBenchmarkScene(BenchmarkScene* scene, ID3D11Device* device)
+{
+    int columns = 1;
+    while (columns * columns < BENCHMARK_OBJECT_COUNT)
+    {
+        columns++;
+    }
+    int instancesPerRow = 1;
+    while (instancesPerRow * instancesPerRow < BENCHMARK_INSTANCES_PER_OBJECT)
+    {
+        instancesPerRow++;
+    }
+    float cellSize = 2.0f / columns;
+
+    scene->d3dObjectCount = (int)(BENCHMARK_OBJECT_COUNT * BENCHMARK_D3D_FRACTION + 0.5);
+    for (int i = 0; i < BENCHMARK_OBJECT_COUNT; i++)
+    {
+        BenchmarkObject& object = scene->objects[i];
+        object.placement[0] = -1.0f + (i % columns) * cellSize;
+        object.placement[1] = -1.0f + (i / columns) * cellSize;
+        object.placement[2] = cellSize;
+        object.placement[3] = (float)instancesPerRow;
+        scene->homes[i][0] = object.placement[0];
+        scene->homes[i][1] = object.placement[1];
+
+        // D3D objects are blue and GL objects are orange, shaded by position so draws can be told apart
+        float shade = 0.5f + 0.5f * (float)i / BENCHMARK_OBJECT_COUNT;
+        bool drawnByD3D = i < scene->d3dObjectCount;
+        object.color[0] = drawnByD3D ? 0.0f : shade;
+        object.color[1] = drawnByD3D ? 0.3f * shade : 0.5f * shade;
+        object.color[2] = drawnByD3D ? shade : 0.0f;
+        object.color[3] = 1.0f;
+    }
+
+    scene->vertexShader = &g_benchmarkVertexShaderD3D;
+    scene->pixelShader = &g_benchmarkPixelShaderD3D;
+    RequestShaderD3D(&g_shaderLoader, scene->vertexShader);
+    RequestShaderD3D(&g_shaderLoader, scene->pixelShader);
+
+    CheckHR(device->CreateBuffer(&CD3D11_BUFFER_DESC(sizeof(BenchmarkObject), D3D11_BIND_CONSTANT_BUFFER), NULL, &scene->constants));
+
+    // Objects don't overlap, and the depth buffer isn't necessarily cleared, so there's no culling or depth testing
+    CD3D11_RASTERIZER_DESC rasterizerDesc(D3D11_DEFAULT);
+    rasterizerDesc.CullMode = D3D11_CULL_NONE;
+    scene->rasterizerState = GetRasterizerState(&g_stateObjects, device, rasterizerDesc);
+    CD3D11_DEPTH_STENCIL_DESC depthStencilDesc(D3D11_DEFAULT);
+    depthStencilDesc.DepthEnable = FALSE;
+    scene->depthStencilState = GetDepthStencilState(&g_stateObjects, device, depthStencilDesc);
+
+    scene->programGL = g_benchmarkProgramGL.program;
+    scene->placementLocationGL = glGetUniformLocation(scene->programGL, "placement");
+    scene->colorLocationGL = glGetUniformLocation(scene->programGL, "color");
+    glGenVertexArrays(1, &scene->vertexArrayGL);
+
+#ifdef USE_GL_MULTI_DRAW_INDIRECT
+    scene->useBatchGL = InitBatchRendererGL(&scene->batchGL, BENCHMARK_OBJECT_COUNT - scene->d3dObjectCount);
+#endif
+}
+
+// Move objects in a small circle around their homes, so the frame has some per-object CPU work
+void AnimateBenchmarkObjects(BenchmarkScene* scene, int first, int last, float seconds)
+{
+    float radius = 0.1f * scene->objects[0].placement[2];
+    for (int i = first; i < last; i++)
+    {
+        float angle = 2.0f * seconds + 0.1f * i;
+        scene->objects[i].placement[0] = scene->homes[i][0] + radius * cosf(angle);
+        scene->objects[i].placement[1] = scene->homes[i][1] + radius * sinf(angle);
+    }
+}
+
+// One range of the benchmark's CPU stages, run as jobs
+struct BenchmarkStageRange
+{
+    BenchmarkScene* scene;
+    int first;
+    int last;
+    float seconds;
+};
+
+void AnimateBenchmarkJob(void* data)
+{
+    BenchmarkStageRange* range = (BenchmarkStageRange*)data;
+    AnimateBenchmarkObjects(range->scene, range->first, range->last, range->seconds);
+}
+
+// Batches the GL objects of the range, which only has some if it ends after the D3D objects
+void FillBatchJob(void* data)
+{
+    BenchmarkStageRange* range = (BenchmarkStageRange*)data;
+    BenchmarkScene* scene = range->scene;
+    int d3dCount = scene->d3dObjectCount;
+    if (range->last > d3dCount)
+    {
+        int first = range->first > d3dCount ? range->first : d3dCount;
+        FillBatchGL(&scene->batchGL, scene->objects + d3dCount, first - d3dCount, range->last - d3dCount);
+    }
+}
+
+// Run the frame's CPU stages: animate the objects, then batch the GL ones, once for every output.
+// With a job system, each range is batched as soon as it's animated, otherwise everything runs on this thread.
+void BeginBenchmarkFrame(BenchmarkScene* scene, float seconds, JobSystem* jobs)
+{
+    LARGE_INTEGER stagesStart;
+    QueryPerformanceCounter(&stagesStart);
+
+    int d3dCount = scene->d3dObjectCount;
+    int glCount = BENCHMARK_OBJECT_COUNT - d3dCount;
+    scene->d3dChunks = AllocateDrawRecords(&g_frameArena, BENCHMARK_API_SWITCHES);
+    scene->glChunks = AllocateDrawRecords(&g_frameArena, BENCHMARK_API_SWITCHES);
+    for (int chunk = 0; chunk < BENCHMARK_API_SWITCHES; chunk++)
+    {
+        scene->d3dChunks[chunk].first = d3dCount * chunk / BENCHMARK_API_SWITCHES;
+        scene->d3dChunks[chunk].last = d3dCount * (chunk + 1) / BENCHMARK_API_SWITCHES;
+        scene->glChunks[chunk].first = d3dCount + glCount * chunk / BENCHMARK_API_SWITCHES;
+        scene->glChunks[chunk].last = d3dCount + glCount * (chunk + 1) / BENCHMARK_API_SWITCHES;
+    }
+
+    if (!jobs)
+    {
+        AnimateBenchmarkObjects(scene, 0, BENCHMARK_OBJECT_COUNT, seconds);
+        if (scene->useBatchGL)
+        {
+            BuildBatchGL(&scene->batchGL, scene->objects + scene->d3dObjectCount, glCount);
+        }
+    }
+    else
+    {
+        // Waiting for the GPU to release the region needs the GL context, so it stays on this thread
+        if (scene->useBatchGL)
+        {
+            BeginBatchGL(&scene->batchGL);
+            scene->batchGL.drawCount = glCount;
+        }
+
+        ResetFrameAllocators(jobs);
+        Job* done = CreateJob(jobs, EmptyJob, NULL);
+        for (int first = 0; first < BENCHMARK_OBJECT_COUNT; first += JOB_GRAIN_SIZE)
+        {
+            BenchmarkStageRange* range = (BenchmarkStageRange*)AllocateFrameMemory(jobs, sizeof(BenchmarkStageRange));
+            range->scene = scene;
+            range->first = first;
+            range->last = first + JOB_GRAIN_SIZE < BENCHMARK_OBJECT_COUNT ? first + JOB_GRAIN_SIZE : BENCHMARK_OBJECT_COUNT;
+            range->seconds = seconds;
+
+            Job* animate = CreateJob(jobs, AnimateBenchmarkJob, range);
+            if (scene->useBatchGL)
+            {
+                Job* fill = CreateJob(jobs, FillBatchJob, range);
+                AddJobDependency(animate, fill);
+                AddJobDependency(fill, done);
+                SubmitJob(jobs, animate);
+                SubmitJob(jobs, fill);
+            }
+            else
+            {
+                AddJobDependency(animate, done);
+                SubmitJob(jobs, animate);
+            }
+        }
+        SubmitJob(jobs, done);
+        WaitForJob(jobs, done);
+    }
+
+    LARGE_INTEGER stagesEnd;
+    QueryPerformanceCounter(&stagesEnd);
+    scene->cpuStageTicks += stagesEnd.QuadPart - stagesStart.QuadPart;
+}
+
+void EndBenchmarkFrame(BenchmarkScene* scene)
+{
+    if (scene->useBatchGL)
+    {
+        EndBatchGL(&scene->batchGL);
+    }
+}
+
+static const char* g_streamVertexGLSL =
+    "#version 430\n"
+    "uniform vec4 rect;\n"
+    "out vec2 uv;\n"
+    "void main() {\n"
+    "    uv = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "    gl_Position = vec4(mix(rect.xy, rect.zw, uv), 0.0, 1.0);\n"
+    "}\n";
+
+static const char* g_streamFragmentGLSL =
+    "#version 430\n"
+    "uniform sampler2D streamed;\n"
+    "in vec2 uv;\n"
+    "out vec4 fragColor;\n"
+    "void main() { fragColor = texture(streamed, uv); }\n";
+
+static ProgramGL g_streamProgramGL = { "streamed texture", g_streamVertexGLSL, g_streamFragmentGLSL };
+
+// Where GL draws the streamed texture, in its half of the window
+static const float g_streamRect[4] = { -0.9f, -0.5f, -0.3f, 0.5f };
+
+// A slot only moves forward through these states, and the ring's slots are used in order
+enum StreamSlotState
+{
+    // The GPU is done with the staging texture
+    STREAM_SLOT_FREE,
+    // Mapped, and being written by the streaming thread
+    STREAM_SLOT_FILLING,
+    // Written, waiting for the main thread to unmap it and copy it into the shared texture
+    STREAM_SLOT_FILLED,
+    // Copied, waiting for the copy to finish on the GPU
+    STREAM_SLOT_IN_FLIGHT,
+};
+
+struct StreamSlot
+{
+    ID3D11Texture2D* staging;
+    ID3D11Query* fence; // issued after the copy out of the staging texture
+    std::atomic<int> state; // StreamSlotState
+
+    // Set while the slot is mapped
+    unsigned char* data;
+    UINT rowPitch;
+    unsigned frame;
+};
+
+// Streams CPU-generated texels into a texture that GL samples. The immediate context maps a ring of staging textures,
+// a background thread writes the texels, and the main thread copies the written ones into the shared texture
+// before the frame locks it for GL, so uploads never happen inside the lock window.
+// Nothing waits: a slot that isn't free yet or can't be mapped without blocking is counted as a stall and retried next frame.
+struct TextureStreamer
+{
+    ID3D11DeviceContext* context;
+    StreamSlot slots[STREAM_RING_SIZE];
+    int nextFill; // slot the main thread maps next
+    int nextCopy; // slot the main thread copies next
+    int nextRetire; // oldest slot that might still be in flight
+    int nextWrite; // slot the streaming thread writes next
+    HANDLE fillsAvailable;
+    unsigned frame;
+
+    ID3D11Texture2D* texture;
+    GLuint textureNameGL;
+    HANDLE textureHandleGL;
+    GLuint vertexArrayGL;
+    GLint rectLocationGL;
+
+    // Since the last report
+    UINT64 bytesUploaded;
+    unsigned uploads;
+    unsigned stalls;
+    std::atomic<LONGLONG> fillTicks;
+};
+
+static TextureStreamer g_textureStreamer;
+
+// A pattern that scrolls with the frame, so a stale upload is visible
+void WriteStreamTexels(unsigned char* data, UINT rowPitch, unsigned frame)
+{
+    for (UINT y = 0; y < STREAM_TEXTURE_SIZE; y++)
+    {
+        UINT32* row = (UINT32*)(data + y * rowPitch);
+        for (UINT x = 0; x < STREAM_TEXTURE_SIZE; x++)
+        {
+            UINT32 value = ((x + frame) ^ y) & 0xFF;
+            row[x] = 0xFF000000 | (value << 16) | ((255 - value) << 8) | (frame & 0xFF);
+        }
+    }
+}
+
+void StreamThreadMain(TextureStreamer* streamer)
+{
+    for (;;)
+    {
+        CheckWin32(WaitForSingleObject(streamer->fillsAvailable, INFINITE) == WAIT_OBJECT_0);
+
+        StreamSlot& slot = streamer->slots[streamer->nextWrite];
+        streamer->nextWrite = (streamer->nextWrite + 1) % STREAM_RING_SIZE;
+        assert(slot.state == STREAM_SLOT_FILLING);
+
+        LARGE_INTEGER fillStart;
+        QueryPerformanceCounter(&fillStart);
+        WriteStreamTexels(slot.data, slot.rowPitch, slot.frame);
+        LARGE_INTEGER fillEnd;
+        QueryPerformanceCounter(&fillEnd);
+        streamer->fillTicks += fillEnd.QuadPart - fillStart.QuadPart;
+
+        slot.state.store(STREAM_SLOT_FILLED, std::memory_order_release);
+    }
+}
+
+void InitTextureStreamer(TextureStreamer* streamer, ID3D11Device* device, ID3D11DeviceContext* context, HANDLE gl_handleD3D)
+{
+    streamer->context = context;
+    CD3D11_TEXTURE2D_DESC stagingDesc(DXGI_FORMAT_R8G8B8A8_UNORM, STREAM_TEXTURE_SIZE, STREAM_TEXTURE_SIZE, 1, 1, 0, D3D11_USAGE_STAGING, D3D11_CPU_ACCESS_WRITE);
+    for (int i = 0; i < STREAM_RING_SIZE; i++)
+    {
+        StreamSlot& slot = streamer->slots[i];
+        CheckHR(device->CreateTexture2D(&stagingDesc, NULL, &slot.staging));
+        CheckHR(device->CreateQuery(&CD3D11_QUERY_DESC(D3D11_QUERY_EVENT), &slot.fence));
+        slot.state = STREAM_SLOT_FREE;
+    }
+    streamer->nextFill = 0;
+    streamer->nextCopy = 0;
+    streamer->nextRetire = 0;
+    streamer->nextWrite = 0;
+    streamer->frame = 0;
+    streamer->fillsAvailable = CreateSemaphore(NULL, 0, STREAM_RING_SIZE, NULL);
+    CheckWin32(streamer->fillsAvailable != NULL);
+
+    CheckHR(device->CreateTexture2D(
+        &CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R8G8B8A8_UNORM, STREAM_TEXTURE_SIZE, STREAM_TEXTURE_SIZE, 1, 1, D3D11_BIND_SHADER_RESOURCE),
+        NULL,
+        &streamer->texture));
+    glGenTextures(1, &streamer->textureNameGL);
+    streamer->textureHandleGL = wglDXRegisterObjectNV(gl_handleD3D, streamer->texture, streamer->textureNameGL, GL_TEXTURE_2D, WGL_ACCESS_READ_ONLY_NV);
+    CheckWin32(streamer->textureHandleGL != NULL);
+
+    // Registering doesn't set the sampler state, and the texture has no mips
+    glBindTexture(GL_TEXTURE_2D, streamer->textureNameGL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    streamer->rectLocationGL = glGetUniformLocation(g_streamProgramGL.program, "rect");
+    glGenVertexArrays(1, &streamer->vertexArrayGL);
+
+    std::thread(StreamThreadMain, streamer).detach();
+}
+
+// Move the ring forward. Call once per frame, while D3D owns the shared texture.
+void UpdateTextureStreamer(TextureStreamer* streamer)
+{
+    ID3D11DeviceContext* context = streamer->context;
+
+    // Copy what the streaming thread finished, in ring order
+    for (;;)
+    {
+        StreamSlot& slot = streamer->slots[streamer->nextCopy];
+        if (slot.state.load(std::memory_order_acquire) != STREAM_SLOT_FILLED)
+        {
+            break;
+        }
+        context->Unmap(slot.staging, 0);
+        context->CopyResource(streamer->texture, slot.staging);
+        context->End(slot.fence);
+        slot.state = STREAM_SLOT_IN_FLIGHT;
+        streamer->nextCopy = (streamer->nextCopy + 1) % STREAM_RING_SIZE;
+        streamer->bytesUploaded += STREAM_TEXTURE_SIZE * STREAM_TEXTURE_SIZE * 4;
+        streamer->uploads++;
+    }
+
+    // Free the slots whose copies are done, without flushing just to find out
+    for (;;)
+    {
+        StreamSlot& slot = streamer->slots[streamer->nextRetire];
+        if (slot.state != STREAM_SLOT_IN_FLIGHT || context->GetData(slot.fence, NULL, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+        {
+            break;
+        }
+        slot.state = STREAM_SLOT_FREE;
+        streamer->nextRetire = (streamer->nextRetire + 1) % STREAM_RING_SIZE;
+    }
+
+    // Hand the next slot to the streaming thread
+    StreamSlot& slot = streamer->slots[streamer->nextFill];
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (slot.state != STREAM_SLOT_FREE ||
+        context->Map(slot.staging, 0, D3D11_MAP_WRITE, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped) != S_OK)
+    {
+        streamer->stalls++;
+        return;
+    }
+    slot.data = (unsigned char*)mapped.pData;
+    slot.rowPitch = mapped.RowPitch;
+    slot.frame = streamer->frame++;
+    slot.state = STREAM_SLOT_FILLING;
+    streamer->nextFill = (streamer->nextFill + 1) % STREAM_RING_SIZE;
+    ReleaseSemaphore(streamer->fillsAvailable, 1, NULL);
+}
+
+// Draw the streamed texture into the bound framebuffer. The texture must be locked for GL.
+void DrawStreamedTextureGL(const TextureStreamer& streamer)
+{
+    SetEnabledGL(GL_DEPTH_TEST, false);
+    glUseProgram(g_streamProgramGL.program);
+    glUniform4fv(streamer.rectLocationGL, 1, g_streamRect);
+    glBindVertexArray(streamer.vertexArrayGL);
+    glBindTexture(GL_TEXTURE_2D, streamer.textureNameGL);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+// A D3D resource registered for GL compute access
+struct ComputeResourceGL
+{
+    GLenum target; // GL_NONE for buffers
+    GLuint name;
+    HANDLE handle;
+};
+
+// D3D buffers and textures that GL compute shaders write, locked together around each group of dispatches,
+// so a group costs one lock and one unlock however many resources and dispatches it has.
+struct ComputeInteropGL
+{
+    HANDLE gl_handleD3D;
+    ComputeResourceGL resources[MAX_COMPUTE_RESOURCES];
+    HANDLE handles[MAX_COMPUTE_RESOURCES];
+    int count;
+};
+
+void InitComputeInteropGL(ComputeInteropGL* interop, HANDLE gl_handleD3D)
+{
+    interop->gl_handleD3D = gl_handleD3D;
+    interop->count = 0;
+}
+
+GLuint RegisterComputeResourceGL(ComputeInteropGL* interop, ID3D11Resource* resource, GLenum target)
+{
+    assert(interop->count < MAX_COMPUTE_RESOURCES);
+    ComputeResourceGL& registered = interop->resources[interop->count];
+    registered.target = target;
+    if (target == GL_NONE)
+    {
+        glGenBuffers(1, &registered.name);
+    }
+    else
+    {
+        glGenTextures(1, &registered.name);
+    }
+    registered.handle = wglDXRegisterObjectNV(interop->gl_handleD3D, resource, registered.name, target, WGL_ACCESS_READ_WRITE_NV);
+    CheckWin32(registered.handle != NULL);
+    interop->handles[interop->count++] = registered.handle;
+    return registered.name;
+}
+
+// Structured and raw buffers are registered without a target, which makes them GL buffers that can be bound as SSBOs
+GLuint RegisterComputeBufferGL(ComputeInteropGL* interop, ID3D11Buffer* buffer)
+{
+    return RegisterComputeResourceGL(interop, buffer, GL_NONE);
+}
+
+// Textures created with D3D11_BIND_UNORDERED_ACCESS, for glBindImageTexture
+GLuint RegisterComputeTextureGL(ComputeInteropGL* interop, ID3D11Texture2D* texture)
+{
+    return RegisterComputeResourceGL(interop, texture, GL_TEXTURE_2D);
+}
+
+// The resources must be unlocked. The D3D resources stay alive, they're only released by their owner.
+void UnregisterComputeResourcesGL(ComputeInteropGL* interop)
+{
+    for (int i = 0; i < interop->count; i++)
+    {
+        ComputeResourceGL& registered = interop->resources[i];
+        CheckWin32(wglDXUnregisterObjectNV(interop->gl_handleD3D, registered.handle) != FALSE);
+        if (registered.target == GL_NONE)
+        {
+            glDeleteBuffers(1, &registered.name);
+        }
+        else
+        {
+            glDeleteTextures(1, &registered.name);
+        }
+    }
+    interop->count = 0;
+}
+
+void BeginComputeGroupGL(ComputeInteropGL* interop)
+{
+    CheckWin32(wglDXLockObjectsNV(interop->gl_handleD3D, interop->count, interop->handles) != FALSE);
+}
+
+void EndComputeGroupGL(ComputeInteropGL* interop)
+{
+    CheckWin32(wglDXUnlockObjectsNV(interop->gl_handleD3D, interop->count, interop->handles) != FALSE);
+}
+
+static const char* g_particleSimulateGLSL =
+    "#version 430\n"
+    "layout(local_size_x = 256) in;\n"
+    "struct Particle { vec2 position; vec2 velocity; };\n"
+    "layout(std430, binding = 0) buffer Particles { Particle particles[]; };\n"
+    "layout(rgba8, binding = 0) uniform image2D trail;\n"
+    "uniform float timeStep;\n"
+    "void main() {\n"
+    "    uint i = gl_GlobalInvocationID.x;\n"
+    "    if (i >= uint(particles.length())) return;\n"
+    "    Particle p = particles[i];\n"
+    "    p.velocity -= p.position * timeStep;\n"
+    "    p.position += p.velocity * timeStep;\n"
+    "    if (abs(p.position.x) > 1.0) { p.velocity.x = -p.velocity.x; p.position.x = clamp(p.position.x, -1.0, 1.0); }\n"
+    "    if (abs(p.position.y) > 1.0) { p.velocity.y = -p.velocity.y; p.position.y = clamp(p.position.y, -1.0, 1.0); }\n"
+    "    particles[i] = p;\n"
+    "    vec2 size = vec2(imageSize(trail) - 1);\n"
+    "    imageStore(trail, ivec2((p.position * 0.5 + 0.5) * size), vec4(1.0, 0.8, 0.3, 1.0));\n"
+    "}\n";
+
+static const char* g_particleFadeGLSL =
+    "#version 430\n"
+    "layout(local_size_x = 16, local_size_y = 16) in;\n"
+    "layout(rgba8, binding = 0) uniform image2D trail;\n"
+    "uniform float fade;\n"
+    "void main() {\n"
+    "    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);\n"
+    "    if (any(greaterThanEqual(texel, imageSize(trail)))) return;\n"
+    "    imageStore(trail, texel, imageLoad(trail, texel) * fade);\n"
+    "}\n";
+
+static ProgramGL g_particleSimulateProgramGL = { "particle simulation", NULL, NULL, g_particleSimulateGLSL };
+static ProgramGL g_particleFadeProgramGL = { "particle trail fade", NULL, NULL, g_particleFadeGLSL };
+
+static const char* g_particleHLSL =
+    "struct Particle { float2 position; float2 velocity; };\n"
+    "StructuredBuffer<Particle> particles : register(t0);\n"
+    "float4 vs_main(uint id : SV_VertexID) : SV_Position { return float4(particles[id].position, 0.0, 1.0); }\n"
+    "float4 ps_main() : SV_Target { return float4(1.0, 1.0, 1.0, 1.0); }\n";
+
+static const char* g_particleTrailHLSL =
+    "Texture2D trail : register(t0);\n"
+    "SamplerState trailSampler : register(s0);\n"
+    "struct Varyings { float4 position : SV_Position; float2 uv : TEXCOORD0; };\n"
+    "Varyings vs_main(uint id : SV_VertexID) {\n"
+    "    Varyings v;\n"
+    "    v.uv = float2(id & 1, id >> 1);\n"
+    "    v.position = float4(lerp(float2(0.1, -0.8), float2(0.9, 0.8), v.uv), 0.0, 1.0);\n"
+    "    return v;\n"
+    "}\n"
+    "float4 ps_main(Varyings v) : SV_Target { return trail.Sample(trailSampler, float2(v.uv.x, 1.0 - v.uv.y)); }\n";
+
+static ShaderD3D g_particleVertexShaderD3D = { g_particleHLSL, "vs_main", "vs_5_0" };
+static ShaderD3D g_particlePixelShaderD3D = { g_particleHLSL, "ps_main", "ps_5_0" };
+static ShaderD3D g_particleTrailVertexShaderD3D = { g_particleTrailHLSL, "vs_main", "vs_5_0" };
+static ShaderD3D g_particleTrailPixelShaderD3D = { g_particleTrailHLSL, "ps_main", "ps_5_0" };
+
+// Same layout in both APIs
+struct Particle
+{
+    float position[2];
+    float velocity[2];
+};
+
+// Particles simulated by GL compute shaders in a D3D structured buffer, which also leave a fading trail in a D3D UAV texture.
+// D3D draws both after GL is done with them.
+struct ParticleSystem
+{
+    ComputeInteropGL interop;
+
+    ID3D11Buffer* particles;
+    ID3D11ShaderResourceView* particlesView;
+    ID3D11Texture2D* trail;
+    ID3D11ShaderResourceView* trailView;
+    ID3D11SamplerState* trailSampler;
+    ID3D11RasterizerState* rasterizerState;
+    ID3D11DepthStencilState* depthStencilState;
+
+    GLuint particlesGL;
+    GLuint trailGL;
+    GLint timeStepLocationGL;
+    GLint fadeLocationGL;
+
+    // Since the last report
+    unsigned dispatches;
+};
+
+static ParticleSystem g_particles;
+
+// Particles start spread over the window, circling the center
+void CreateParticleBufferD3D(ID3D11Device* device, ID3D11Buffer** buffer)
+{
+    Particle* particles = new Particle[PARTICLE_COUNT];
+    for (int i = 0; i < PARTICLE_COUNT; i++)
+    {
+        float angle = 6.2831853f * i / PARTICLE_COUNT;
+        float radius = 0.2f + 0.7f * (float)((i * 7919) % PARTICLE_COUNT) / PARTICLE_COUNT;
+        particles[i].position[0] = radius * cosf(angle);
+        particles[i].position[1] = radius * sinf(angle);
+        particles[i].velocity[0] = -particles[i].position[1];
+        particles[i].velocity[1] = particles[i].position[0];
+    }
+
+    D3D11_SUBRESOURCE_DATA initialData = {};
+    initialData.pSysMem = particles;
+    CheckHR(device->CreateBuffer(
+        &CD3D11_BUFFER_DESC(PARTICLE_COUNT * sizeof(Particle), D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED, sizeof(Particle)),
+        &initialData,
+        buffer));
+    delete[] particles;
+}
+
+void InitParticleSystem(ParticleSystem* system, ID3D11Device* device, HANDLE gl_handleD3D)
+{
+    CreateParticleBufferD3D(device, &system->particles);
+    CheckHR(device->CreateShaderResourceView(system->particles,
+        &CD3D11_SHADER_RESOURCE_VIEW_DESC(system->particles, DXGI_FORMAT_UNKNOWN, 0, PARTICLE_COUNT),
+        &system->particlesView));
+
+    CheckHR(device->CreateTexture2D(
+        &CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R8G8B8A8_UNORM, PARTICLE_TRAIL_SIZE, PARTICLE_TRAIL_SIZE, 1, 1, D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE),
+        NULL,
+        &system->trail));
+    CheckHR(device->CreateShaderResourceView(system->trail, NULL, &system->trailView));
+    CheckHR(device->CreateSamplerState(&CD3D11_SAMPLER_DESC(D3D11_DEFAULT), &system->trailSampler));
+
+    CD3D11_RASTERIZER_DESC rasterizerDesc(D3D11_DEFAULT);
+    rasterizerDesc.CullMode = D3D11_CULL_NONE;
+    system->rasterizerState = GetRasterizerState(&g_stateObjects, device, rasterizerDesc);
+    CD3D11_DEPTH_STENCIL_DESC depthStencilDesc(D3D11_DEFAULT);
+    depthStencilDesc.DepthEnable = FALSE;
+    system->depthStencilState = GetDepthStencilState(&g_stateObjects, device, depthStencilDesc);
+
+    RequestShaderD3D(&g_shaderLoader, &g_particleVertexShaderD3D);
+    RequestShaderD3D(&g_shaderLoader, &g_particlePixelShaderD3D);
+    RequestShaderD3D(&g_shaderLoader, &g_particleTrailVertexShaderD3D);
+    RequestShaderD3D(&g_shaderLoader, &g_particleTrailPixelShaderD3D);
+
+    InitComputeInteropGL(&system->interop, gl_handleD3D);
+    system->particlesGL = RegisterComputeBufferGL(&system->interop, system->particles);
+    system->trailGL = RegisterComputeTextureGL(&system->interop, system->trail);
+    system->timeStepLocationGL = glGetUniformLocation(g_particleSimulateProgramGL.program, "timeStep");
+    system->fadeLocationGL = glGetUniformLocation(g_particleFadeProgramGL.program, "fade");
+    system->dispatches = 0;
+}
+
+// One simulation step, splatting the particles into the trail. The particle buffer and trail must be locked for GL.
+void DispatchParticleStepGL(ParticleSystem* system, GLuint particlesGL, GLuint trailGL, float timeStep)
+{
+    glUseProgram(g_particleSimulateProgramGL.program);
+    glUniform1f(system->timeStepLocationGL, timeStep);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particlesGL);
+    glBindImageTexture(0, trailGL, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+    glDispatchCompute((PARTICLE_COUNT + 255) / 256, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    system->dispatches++;
+}
+
+// The frame's dispatch group: fade the trail, then move the particles
+void DispatchParticlesGL(ParticleSystem* system, float timeStep)
+{
+    glUseProgram(g_particleFadeProgramGL.program);
+    glUniform1f(system->fadeLocationGL, PARTICLE_TRAIL_FADE);
+    glBindImageTexture(0, system->trailGL, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+    glDispatchCompute((PARTICLE_TRAIL_SIZE + 15) / 16, (PARTICLE_TRAIL_SIZE + 15) / 16, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    system->dispatches++;
+
+    DispatchParticleStepGL(system, system->particlesGL, system->trailGL, timeStep);
+}
+
+// Draw the trail and the particles into the bound render target, once GL has unlocked them
+void DrawParticlesD3D(ParticleSystem* system, D3DStateTracker* tracker)
+{
+    ID3D11DeviceContext* context = tracker->context;
+    SetRasterizerStateD3D(tracker, system->rasterizerState);
+    SetDepthStencilStateD3D(tracker, system->depthStencilState, 0);
+    context->IASetInputLayout(NULL);
+
+    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+    context->VSSetShader(GetVertexShaderD3D(&g_shaderLoader, &g_particleTrailVertexShaderD3D), NULL, 0);
+    context->PSSetShader(GetPixelShaderD3D(&g_shaderLoader, &g_particleTrailPixelShaderD3D), NULL, 0);
+    context->PSSetShaderResources(0, 1, &system->trailView);
+    context->PSSetSamplers(0, 1, &system->trailSampler);
+    context->Draw(4, 0);
+
+    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST);
+    context->VSSetShader(GetVertexShaderD3D(&g_shaderLoader, &g_particleVertexShaderD3D), NULL, 0);
+    context->VSSetShaderResources(0, 1, &system->particlesView);
+    context->PSSetShader(GetPixelShaderD3D(&g_shaderLoader, &g_particlePixelShaderD3D), NULL, 0);
+    context->Draw(PARTICLE_COUNT, 0);
+
+    // GL writes them next frame, so D3D shouldn't keep them bound
+    ID3D11ShaderResourceView* nullView = NULL;
+    context->VSSetShaderResources(0, 1, &nullView);
+    context->PSSetShaderResources(0, 1, &nullView);
+}
+
+// Time COMPUTE_BENCHMARK_DISPATCHES simulation steps on resources of its own, first as one dispatch group
+// with a single lock, then handing them back to D3D after every dispatch, which D3D then reads from.
+// The resources are registered and unregistered around the benchmark, like any short-lived compute resource.
+void BenchmarkComputeInterop(ParticleSystem* system, ID3D11Device* device, ID3D11DeviceContext* devCtx, HANDLE gl_handleD3D)
+{
+    ID3D11Buffer* particles;
+    CreateParticleBufferD3D(device, &particles);
+    ID3D11Texture2D* trail;
+    CheckHR(device->CreateTexture2D(
+        &CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R8G8B8A8_UNORM, PARTICLE_TRAIL_SIZE, PARTICLE_TRAIL_SIZE, 1, 1, D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE),
+        NULL,
+        &trail));
+    ID3D11Buffer* probe;
+    CheckHR(device->CreateBuffer(&CD3D11_BUFFER_DESC(sizeof(Particle), D3D11_BIND_SHADER_RESOURCE), NULL, &probe));
+    ID3D11Query* done;
+    CheckHR(device->CreateQuery(&CD3D11_QUERY_DESC(D3D11_QUERY_EVENT), &done));
+    D3D11_BOX firstParticle = { 0, 0, 0, sizeof(Particle), 1, 1 };
+
+    ComputeInteropGL interop;
+    InitComputeInteropGL(&interop, gl_handleD3D);
+    GLuint particlesGL = RegisterComputeBufferGL(&interop, particles);
+    GLuint trailGL = RegisterComputeTextureGL(&interop, trail);
+
+    double groupMs[2];
+    for (int handoffs = 0; handoffs < 2; handoffs++)
+    {
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+        for (int i = 0; i < COMPUTE_BENCHMARK_DISPATCHES; i++)
+        {
+            if (handoffs || i == 0)
+            {
+                BeginComputeGroupGL(&interop);
+            }
+            DispatchParticleStepGL(system, particlesGL, trailGL, PARTICLE_TIME_STEP);
+            if (handoffs || i == COMPUTE_BENCHMARK_DISPATCHES - 1)
+            {
+                EndComputeGroupGL(&interop);
+                devCtx->CopySubresourceRegion(probe, 0, 0, 0, 0, particles, 0, &firstParticle);
+            }
+        }
+        devCtx->End(done);
+        while (devCtx->GetData(done, NULL, 0, 0) != S_OK)
+        {
+            SwitchToThread();
+        }
+        LARGE_INTEGER end;
+        QueryPerformanceCounter(&end);
+        groupMs[handoffs] = ElapsedMs(start, end);
+    }
+
+    char buf[256];
+    sprintf_s(buf, "Compute interop: %.0f dispatches/s in one group, %.0f dispatches/s with a D3D handoff after each (%d particles)\n",
+        COMPUTE_BENCHMARK_DISPATCHES / (groupMs[0] / 1000.0),
+        COMPUTE_BENCHMARK_DISPATCHES / (groupMs[1] / 1000.0),
+        PARTICLE_COUNT);
+    OutputDebugStringA(buf);
+
+    UnregisterComputeResourcesGL(&interop);
+    done->Release();
+    probe->Release();
+    trail->Release();
+    particles->Release();
+    system->dispatches = 0;
+}
+
+// Build the GL programs that the enabled features draw with
+void LoadProgramsGL(ProgramCacheGL* cache)
+{
+#ifdef SHARED_DEPTH_TEST
+    RequestProgramGL(cache, &g_depthSceneProgramGL);
+#endif
+#ifdef BENCHMARK_SCENE
+    RequestProgramGL(cache, &g_benchmarkProgramGL);
+#ifdef USE_GL_MULTI_DRAW_INDIRECT
+    RequestProgramGL(cache, &g_batchProgramGL);
+#endif
+#endif
+#ifdef TEXTURE_STREAMING
+    RequestProgramGL(cache, &g_streamProgramGL);
+#endif
+#ifdef COMPUTE_INTEROP
+    RequestProgramGL(cache, &g_particleSimulateProgramGL);
+    RequestProgramGL(cache, &g_particleFadeProgramGL);
+#endif
+    FinishProgramsGL(cache);
+}
+
+void DrawBenchmarkObjectsD3D(BenchmarkScene* scene, D3DStateTracker* tracker, int first, int last)
+{
+    ID3D11DeviceContext* context = tracker->context;
+    context->IASetInputLayout(NULL);
+    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+    context->VSSetShader(GetVertexShaderD3D(&g_shaderLoader, scene->vertexShader), NULL, 0);
+    context->VSSetConstantBuffers(0, 1, &scene->constants);
+    context->PSSetShader(GetPixelShaderD3D(&g_shaderLoader, scene->pixelShader), NULL, 0);
+    context->PSSetConstantBuffers(0, 1, &scene->constants);
+    SetRasterizerStateD3D(tracker, scene->rasterizerState);
+    SetDepthStencilStateD3D(tracker, scene->depthStencilState, 0);
+
+    for (int i = first; i < last; i++)
+    {
+        context->UpdateSubresource(scene->constants, 0, NULL, &scene->objects[i], 0, 0);
+        context->DrawInstanced(4, BENCHMARK_INSTANCES_PER_OBJECT, 0, 0);
+    }
+}
+
+void DrawBenchmarkObjectsGL(BenchmarkScene* scene, int first, int last)
+{
+    SetEnabledGL(GL_SCISSOR_TEST, false);
+    SetEnabledGL(GL_DEPTH_TEST, false);
+
+    if (scene->useBatchGL)
+    {
+        DrawBatchGL(&scene->batchGL, first - scene->d3dObjectCount, last - scene->d3dObjectCount);
+        scene->drawCalls += last - first;
+        return;
+    }
+
+    glUseProgram(scene->programGL);
+    glBindVertexArray(scene->vertexArrayGL);
+
+    for (int i = first; i < last; i++)
+    {
+        glUniform4fv(scene->placementLocationGL, 1, scene->objects[i].placement);
+        glUniform4fv(scene->colorLocationGL, 1, scene->objects[i].color);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, BENCHMARK_INSTANCES_PER_OBJECT);
+    }
+    scene->drawCalls += last - first;
+}
+
+// A way of getting GL rendering into the swap chain.
+// Which of these work depends on the vendor and driver (see README), so they're probed at startup.
+struct InteropStrategy
+{
+    const char* name;
+    DXGI_SWAP_EFFECT swapEffect;
+    // Register the backbuffer directly, or render to an offscreen texture that's copied to the backbuffer
+    bool copyToBackbuffer;
+    // GL_TEXTURE_2D or GL_RENDERBUFFER
+    GLenum registrationTarget;
+};
+
+static const InteropStrategy g_interopStrategies[] = {
+    { "FLIP_DISCARD, direct, texture", DXGI_SWAP_EFFECT_FLIP_DISCARD, false, GL_TEXTURE_2D },
+    { "FLIP_DISCARD, direct, renderbuffer", DXGI_SWAP_EFFECT_FLIP_DISCARD, false, GL_RENDERBUFFER },
+    { "DISCARD, direct, texture", DXGI_SWAP_EFFECT_DISCARD, false, GL_TEXTURE_2D },
+    { "DISCARD, direct, renderbuffer", DXGI_SWAP_EFFECT_DISCARD, false, GL_RENDERBUFFER },
+    { "FLIP_DISCARD, copy, texture", DXGI_SWAP_EFFECT_FLIP_DISCARD, true, GL_TEXTURE_2D },
+    { "FLIP_DISCARD, copy, renderbuffer", DXGI_SWAP_EFFECT_FLIP_DISCARD, true, GL_RENDERBUFFER },
+    // The only swap effect that keeps the buffers' contents and accepts dirty rectangles
+    { "FLIP_SEQUENTIAL, direct, texture", DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL, false, GL_TEXTURE_2D },
+    { "FLIP_SEQUENTIAL, direct, renderbuffer", DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL, false, GL_RENDERBUFFER },
+};
+
+// Used when no strategy passes the probe. Copying avoids wrapping swap chain buffers, which is where most of the bugs are.
+#define FALLBACK_INTEROP_STRATEGY 4
+// Same, for multisampled rendering
+#define FALLBACK_MSAA_INTEROP_STRATEGY 5
+
+// A format for the shared depth buffer.
+// The texture is typeless so it could also be read as a shader resource, and the view format is what D3D and GL test against.
+struct DepthFormat
+{
+    const char* name;
+    DXGI_FORMAT textureFormat;
+    DXGI_FORMAT viewFormat;
+    UINT bytesPerPixel;
+    bool hasStencil;
+};
+
+// Cheapest first, which is the order they're tried in when negotiating
+static const DepthFormat g_depthFormats[] = {
+    { "D16_UNORM", DXGI_FORMAT_R16_TYPELESS, DXGI_FORMAT_D16_UNORM, 2, false },
+    { "D24_UNORM_S8_UINT", DXGI_FORMAT_R24G8_TYPELESS, DXGI_FORMAT_D24_UNORM_S8_UINT, 4, true },
+    { "D32_FLOAT", DXGI_FORMAT_R32_TYPELESS, DXGI_FORMAT_D32_FLOAT, 4, false },
+    { "D32_FLOAT_S8X24_UINT", DXGI_FORMAT_R32G8X24_TYPELESS, DXGI_FORMAT_D32_FLOAT_S8X24_UINT, 8, true },
+};
+
+// Used for probing interop strategies, and when no format passes the negotiation
+#define FALLBACK_DEPTH_FORMAT 3
+
+// A format for the swap chains and shared color buffers, with the GL internal format a registered buffer of it has
+struct ColorFormat
+{
+    const char* name;
+    DXGI_FORMAT format;
+    DXGI_COLOR_SPACE_TYPE colorSpace;
+    GLenum internalFormatGL;
+};
+
+// Indexed by ColorFormatIndex
+static const ColorFormat g_colorFormats[] = {
+    { "R8G8B8A8_UNORM", DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_COLOR_SPACE_RGB_FULL_G22_NONE_P709, GL_RGBA8 },
+    { "R10G10B10A2_UNORM", DXGI_FORMAT_R10G10B10A2_UNORM, DXGI_COLOR_SPACE_RGB_FULL_G22_NONE_P709, GL_RGB10_A2 },
+    { "R10G10B10A2_UNORM HDR10", DXGI_FORMAT_R10G10B10A2_UNORM, DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020, GL_RGB10_A2 },
+    { "R16G16B16A16_FLOAT scRGB", DXGI_FORMAT_R16G16B16A16_FLOAT, DXGI_COLOR_SPACE_RGB_FULL_G10_NONE_P709, GL_RGBA16F },
+};
+
+GLenum DepthAttachmentGL(const DepthFormat& format)
+{
+    return format.hasStencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+}
+
+UINT DepthClearFlags(const DepthFormat& format)
+{
+    return format.hasStencil ? D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL : D3D11_CLEAR_DEPTH;
+}
+
+bool IsFlipModel(DXGI_SWAP_EFFECT swapEffect)
+{
+    return swapEffect == DXGI_SWAP_EFFECT_FLIP_DISCARD || swapEffect == DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
+}
+
+// Multisampled buffers have to be registered as renderbuffers, and resolved into the swap chain rather than being part of it
+bool IsStrategyUsable(const InteropStrategy& strategy, UINT sampleCount)
+{
+    return sampleCount == 1 || (strategy.copyToBackbuffer && strategy.registrationTarget == GL_RENDERBUFFER);
+}
+
+// Find the highest sample count up to the requested one that both shared formats support.
+// The depth buffer is typeless, so its typed depth format is the one checked.
+UINT ChooseSampleCount(ID3D11Device* device, UINT requestedCount, const ColorFormat& colorFormat, const DepthFormat& depthFormat)
+{
+    for (UINT count = requestedCount; count > 1; count /= 2)
+    {
+        UINT colorQualityLevels = 0;
+        UINT depthQualityLevels = 0;
+        if (SUCCEEDED(device->CheckMultisampleQualityLevels(colorFormat.format, count, &colorQualityLevels)) &&
+            SUCCEEDED(device->CheckMultisampleQualityLevels(depthFormat.viewFormat, count, &depthQualityLevels)) &&
+            colorQualityLevels > 0 && depthQualityLevels > 0)
+        {
+            return count;
+        }
+
+        char buf[128];
+        sprintf_s(buf, "%ux MSAA isn't supported for %s with %s\n", count, colorFormat.name, depthFormat.name);
+        OutputDebugStringA(buf);
+    }
+    return 1;
+}
+
+// Generate a GL texture or renderbuffer name for registering a D3D resource
+GLuint GenObjectGL(GLenum target)
+{
+    GLuint name;
+    if (target == GL_RENDERBUFFER)
+    {
+        glGenRenderbuffers(1, &name);
+    }
+    else
+    {
+        glGenTextures(1, &name);
+    }
+    return name;
+}
+
+void DeleteObjectGL(GLenum target, GLuint name)
+{
+    if (target == GL_RENDERBUFFER)
+    {
+        glDeleteRenderbuffers(1, &name);
+    }
+    else
+    {
+        glDeleteTextures(1, &name);
+    }
+}
+
+// Attach a registered texture or renderbuffer to the currently bound FBO
+void AttachObjectGL(GLenum attachment, GLenum target, GLuint name)
+{
+    if (target == GL_RENDERBUFFER)
+    {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, name);
+    }
+    else
+    {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, name, 0);
+    }
+}
+
+// A set of rectangles touched by rendering, in D3D (top-left origin) coordinates
+struct DamageRegion
+{
+    RECT rects[MAX_DIRTY_RECTS];
+    UINT count;
+};
+
+LONG RectArea(const RECT& r)
+{
+    return (r.right - r.left) * (r.bottom - r.top);
+}
+
+RECT UnionRects(const RECT& a, const RECT& b)
+{
+    RECT u = {
+        a.left < b.left ? a.left : b.left,
+        a.top < b.top ? a.top : b.top,
+        a.right > b.right ? a.right : b.right,
+        a.bottom > b.bottom ? a.bottom : b.bottom
+    };
+    return u;
+}
+
+bool RectsTouch(const RECT& a, const RECT& b)
+{
+    return a.left <= b.right && b.left <= a.right && a.top <= b.bottom && b.top <= a.bottom;
+}
+
+// Add a rectangle clipped to the surface. Rectangles that overlap or touch are merged.
+// When the region is full, the rectangle is merged into the one whose area grows the least.
+void AddDamage(DamageRegion* region, RECT rect, LONG width, LONG height)
+{
+    RECT surface = { 0, 0, width, height };
+    rect.left = rect.left > surface.left ? rect.left : surface.left;
+    rect.top = rect.top > surface.top ? rect.top : surface.top;
+    rect.right = rect.right < surface.right ? rect.right : surface.right;
+    rect.bottom = rect.bottom < surface.bottom ? rect.bottom : surface.bottom;
+    if (rect.right <= rect.left || rect.bottom <= rect.top)
+    {
+        return;
+    }
+
+    // Merging can make the rectangle touch others, so repeat until it doesn't
+    for (UINT i = 0; i < region->count; )
+    {
+        if (RectsTouch(rect, region->rects[i]))
+        {
+            rect = UnionRects(rect, region->rects[i]);
+            region->rects[i] = region->rects[--region->count];
+            i = 0;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    if (region->count < MAX_DIRTY_RECTS)
+    {
+        region->rects[region->count++] = rect;
+        return;
+    }
+
+    UINT best = 0;
+    LONG bestGrowth = 0;
+    for (UINT i = 0; i < region->count; i++)
+    {
+        LONG growth = RectArea(UnionRects(rect, region->rects[i])) - RectArea(region->rects[i]);
+        if (i == 0 || growth < bestGrowth)
+        {
+            best = i;
+            bestGrowth = growth;
+        }
+    }
+
+    RECT grown = UnionRects(rect, region->rects[best]);
+    region->rects[best] = region->rects[--region->count];
+    AddDamage(region, grown, width, height);
+}
+
+// Add a rectangle in GL (bottom-left origin) coordinates, like the ones passed to glScissor
+void AddDamageGL(DamageRegion* region, GLint x, GLint y, GLsizei w, GLsizei h, LONG width, LONG height)
+{
+    RECT rect = { x, height - (y + h), x + w, height - y };
+    AddDamage(region, rect, width, height);
+}
+
+// The streamed texture changes every frame, but only inside its rectangle. Rounded outwards, so partly covered pixels count.
+void AddStreamedTextureDamage(DamageRegion* region, LONG width, LONG height)
+{
+    GLint left = (GLint)floorf((g_streamRect[0] * 0.5f + 0.5f) * width);
+    GLint bottom = (GLint)floorf((g_streamRect[1] * 0.5f + 0.5f) * height);
+    GLint right = (GLint)ceilf((g_streamRect[2] * 0.5f + 0.5f) * width);
+    GLint top = (GLint)ceilf((g_streamRect[3] * 0.5f + 0.5f) * height);
+    AddDamageGL(region, left, bottom, right - left, top - bottom, width, height);
+}
+
+// When a present was issued, looked up once the frame statistics say it was displayed
+struct PresentRecord
+{
+    UINT presentCount;
+    LONGLONG issuedTicks;
+};
+
+// What DXGI's frame statistics say reached the display, as opposed to what the CPU submitted.
+// Every present is recorded with its PresentCount, and the statistics polled after it tell which present
+// was last displayed and at which vblank, which gives its latency, the vblanks missed since the previous one,
+// and how many presents are still queued behind it.
+struct PresentMonitor
+{
+    PresentRecord history[PRESENT_MONITOR_HISTORY];
+    UINT lastPresentCount; // of the last present issued
+
+    // The last present seen displayed and the vblank it was displayed at. There's none while displayedTicks is 0.
+    UINT displayedPresentCount;
+    UINT displayedRefreshCount;
+    LONGLONG displayedTicks;
+    // Measured between the vblanks seen, 0 until two were
+    double refreshPeriodTicks;
+
+    // Since the last report
+    unsigned displayed;
+    unsigned missedVblanks;
+    unsigned latencySamples;
+    LONGLONG totalLatencyTicks;
+    LONGLONG maxLatencyTicks;
+    unsigned polls;
+    unsigned totalQueueDepth;
+    unsigned maxQueueDepth;
+    unsigned unavailable; // polls the statistics weren't available for, like with bitblt model swap chains in a window
+};
+
+// Forget the last displayed present, so a gap in the presents (like occlusion) isn't counted as missed vblanks
+void RestartPresentMonitor(PresentMonitor* monitor)
+{
+    monitor->displayedTicks = 0;
+}
+
+void RecordPresent(PresentMonitor* monitor, UINT presentCount, LONGLONG issuedTicks)
+{
+    PresentRecord& record = monitor->history[presentCount % PRESENT_MONITOR_HISTORY];
+    record.presentCount = presentCount;
+    record.issuedTicks = issuedTicks;
+    monitor->lastPresentCount = presentCount;
+}
+
+// Correlate a statistics sample with the presents recorded. The sample's PresentCount was displayed at vblank PresentRefreshCount,
+// and SyncQPCTime is the time of vblank SyncRefreshCount, which is the same one unless the sample was taken later.
+// Missed vblanks are only counted when presents wait for vblank, since immediate presents aren't expected to make every one.
+void RecordFrameStatistics(PresentMonitor* monitor, const DXGI_FRAME_STATISTICS& stats, UINT syncInterval)
+{
+    monitor->polls++;
+    UINT queueDepth = monitor->lastPresentCount - stats.PresentCount;
+    monitor->totalQueueDepth += queueDepth;
+    if (queueDepth > monitor->maxQueueDepth)
+    {
+        monitor->maxQueueDepth = queueDepth;
+    }
+
+    bool sameVblank = stats.SyncRefreshCount == stats.PresentRefreshCount;
+    if (stats.SyncQPCTime.QuadPart == 0 ||
+        (monitor->displayedTicks != 0 && stats.PresentCount == monitor->displayedPresentCount) ||
+        (!sameVblank && monitor->refreshPeriodTicks == 0.0))
+    {
+        return;
+    }
+
+    LONGLONG vblankTicks = stats.SyncQPCTime.QuadPart;
+    if (!sameVblank)
+    {
+        vblankTicks -= (LONGLONG)((stats.SyncRefreshCount - stats.PresentRefreshCount) * monitor->refreshPeriodTicks);
+    }
+
+    if (monitor->displayedTicks != 0)
+    {
+        UINT presents = stats.PresentCount - monitor->displayedPresentCount;
+        UINT refreshes = stats.PresentRefreshCount - monitor->displayedRefreshCount;
+        if (syncInterval > 0 && refreshes > presents * syncInterval)
+        {
+            monitor->missedVblanks += refreshes - presents * syncInterval;
+        }
+        if (sameVblank && refreshes > 0)
+        {
+            double periodTicks = (double)(vblankTicks - monitor->displayedTicks) / refreshes;
+            monitor->refreshPeriodTicks = monitor->refreshPeriodTicks == 0.0 ? periodTicks : monitor->refreshPeriodTicks + (periodTicks - monitor->refreshPeriodTicks) / 16.0;
+        }
+        monitor->displayed += presents;
+    }
+    else
+    {
+        monitor->displayed++;
+    }
+
+    // Only the latest displayed present is sampled, the ones displayed between two polls have no time of their own
+    const PresentRecord& record = monitor->history[stats.PresentCount % PRESENT_MONITOR_HISTORY];
+    if (record.presentCount == stats.PresentCount && record.issuedTicks != 0 && vblankTicks >= record.issuedTicks)
+    {
+        LONGLONG latencyTicks = vblankTicks - record.issuedTicks;
+        monitor->totalLatencyTicks += latencyTicks;
+        if (latencyTicks > monitor->maxLatencyTicks)
+        {
+            monitor->maxLatencyTicks = latencyTicks;
+        }
+        monitor->latencySamples++;
+    }
+
+    monitor->displayedPresentCount = stats.PresentCount;
+    monitor->displayedRefreshCount = stats.PresentRefreshCount;
+    monitor->displayedTicks = vblankTicks;
+}
+
+// Called right after each present of the swap chain
+void PollPresentMonitor(PresentMonitor* monitor, IDXGISwapChain* swapChain, LONGLONG issuedTicks, UINT syncInterval)
+{
+    UINT presentCount;
+    if (SUCCEEDED(swapChain->GetLastPresentCount(&presentCount)))
+    {
+        RecordPresent(monitor, presentCount, issuedTicks);
+    }
+
+    DXGI_FRAME_STATISTICS stats;
+    HRESULT hr = swapChain->GetFrameStatistics(&stats);
+    if (FAILED(hr))
+    {
+        // Disjoint means the counts restarted, like after a mode change
+        if (hr == DXGI_ERROR_FRAME_STATISTICS_DISJOINT)
+        {
+            RestartPresentMonitor(monitor);
+        }
+        monitor->polls++;
+        monitor->unavailable++;
+        return;
+    }
+    RecordFrameStatistics(monitor, stats, syncInterval);
+}
+
+// Print the summary since the last report and start the next one
+void ReportPresentMonitor(PresentMonitor* monitor, int outputIndex, LONGLONG qpcFrequency)
+{
+    char buf[256];
+    if (monitor->polls > 0 && monitor->unavailable == monitor->polls)
+    {
+        sprintf_s(buf, "Output %d presents: frame statistics unavailable\n", outputIndex);
+    }
+    else
+    {
+        sprintf_s(buf, "Output %d presents: %u displayed, %u missed vblanks, %.3f ms to display (%.3f max), queue depth %.2f (%u max), %.2f Hz\n",
+            outputIndex,
+            monitor->displayed,
+            monitor->missedVblanks,
+            monitor->latencySamples ? 1000.0 * monitor->totalLatencyTicks / qpcFrequency / monitor->latencySamples : 0.0,
+            1000.0 * monitor->maxLatencyTicks / qpcFrequency,
+            monitor->polls ? (double)monitor->totalQueueDepth / monitor->polls : 0.0,
+            monitor->maxQueueDepth,
+            monitor->refreshPeriodTicks > 0.0 ? qpcFrequency / monitor->refreshPeriodTicks : 0.0);
+    }
+    OutputDebugStringA(buf);
+
+    monitor->displayed = 0;
+    monitor->missedVblanks = 0;
+    monitor->latencySamples = 0;
+    monitor->totalLatencyTicks = 0;
+    monitor->maxLatencyTicks = 0;
+    monitor->polls = 0;
+    monitor->totalQueueDepth = 0;
+    monitor->maxQueueDepth = 0;
+    monitor->unavailable = 0;
+}
+
+// Delays the start of each frame so it finishes just before the vblank it's displayed at, instead of finishing early
+// and waiting in the present queue. Input is then sampled that much later, which is the latency saved.
+// The next vblank is predicted from a present monitor, and the frame's duration from the slowest of the recent frames.
+struct FramePacer
+{
+    HANDLE timer;
+    LONGLONG qpcFrequency;
+    LONGLONG marginTicks;
+
+    // CPU time the frame's work took, from its start to its last present, without the time spent blocked on the swap chains
+    LONGLONG workTicks[FRAME_PACER_HISTORY];
+    int frames; // recorded in the history so far, up to FRAME_PACER_HISTORY
+    int next;
+
+    // The vblank the current frame aims at, 0 if there was no prediction
+    LONGLONG targetVblank;
+    LONGLONG lastTargetVblank;
+
+    // Since the last report. The GL ticks are the part of the work GL had the buffers locked.
+    LONGLONG totalDelayTicks;
+    LONGLONG totalWorkTicks;
+    LONGLONG totalGLTicks;
+    unsigned paced;
+    unsigned unpredicted;
+    unsigned deadlineMisses;
+};
+
+void InitFramePacer(FramePacer* pacer)
+{
+    *pacer = {};
+    pacer->timer = CreateHighResolutionTimer();
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    pacer->qpcFrequency = frequency.QuadPart;
+    pacer->marginTicks = (LONGLONG)(frequency.QuadPart * FRAME_PACER_MARGIN_MS / 1000.0);
+}
+
+// The first vblank after a time, extrapolated from the last one the monitor saw displayed
+LONGLONG PredictVblank(const PresentMonitor& monitor, LONGLONG after)
+{
+    LONGLONG periods = (LONGLONG)((after - monitor.displayedTicks) / monitor.refreshPeriodTicks) + 1;
+    return monitor.displayedTicks + (LONGLONG)(periods * monitor.refreshPeriodTicks);
+}
+
+// The slowest of the recent frames, so a frame that's a bit slower than the average still makes it
+LONGLONG PredictFrameWork(const FramePacer& pacer)
+{
+    LONGLONG slowest = 0;
+    for (int i = 0; i < pacer.frames; i++)
+    {
+        slowest = pacer.workTicks[i] > slowest ? pacer.workTicks[i] : slowest;
+    }
+    return slowest;
+}
+
+// Called before the frame samples input. Doesn't wait until the monitor has seen two vblanks and a few frames were timed.
+void WaitForFrameDeadline(FramePacer* pacer, const PresentMonitor& monitor)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    pacer->targetVblank = 0;
+    if (monitor.displayedTicks == 0 || monitor.refreshPeriodTicks == 0.0 || pacer->frames < FRAME_PACER_HISTORY / 4)
+    {
+        pacer->unpredicted++;
+        return;
+    }
+
+    LONGLONG workTicks = PredictFrameWork(*pacer) + pacer->marginTicks;
+    LONGLONG vblank = PredictVblank(monitor, now.QuadPart + workTicks);
+
+    // Each present takes a vblank of its own, so aiming at the previous frame's vblank would only queue behind it
+    if (vblank - pacer->lastTargetVblank < (LONGLONG)(monitor.refreshPeriodTicks / 2))
+    {
+        vblank = PredictVblank(monitor, pacer->lastTargetVblank);
+    }
+    pacer->targetVblank = vblank;
+    pacer->lastTargetVblank = vblank;
+
+    LONGLONG start = vblank - workTicks;
+    if (start > now.QuadPart)
+    {
+        SleepUntil(pacer->timer, start, pacer->qpcFrequency);
+        pacer->totalDelayTicks += start - now.QuadPart;
+    }
+    pacer->paced++;
+}
+
+// Called once the frame's last present returned.
+// The blocked ticks are spent waiting on the frame latency objects and in Present, which the work doesn't predict:
+// they depend on how full the present queue is, which is what pacing changes.
+void EndPacedFrame(FramePacer* pacer, LONGLONG workStart, LONGLONG blockedTicks, LONGLONG glTicks, LONGLONG presented)
+{
+    LONGLONG workTicks = presented - workStart - blockedTicks;
+    pacer->workTicks[pacer->next] = workTicks;
+    pacer->next = (pacer->next + 1) % FRAME_PACER_HISTORY;
+    pacer->frames = pacer->frames < FRAME_PACER_HISTORY ? pacer->frames + 1 : FRAME_PACER_HISTORY;
+
+    pacer->totalWorkTicks += workTicks;
+    pacer->totalGLTicks += glTicks;
+    if (pacer->targetVblank != 0 && presented > pacer->targetVblank)
+    {
+        pacer->deadlineMisses++;
+    }
+}
+
+void ReportFramePacer(FramePacer* pacer, unsigned frames)
+{
+    char buf[256];
+    sprintf_s(buf, "Frame pacing: %.3f ms input latency saved, %.1f%% deadlines missed, %u frames unpredicted, phases D3D %.3f ms GL %.3f ms\n",
+        pacer->paced ? 1000.0 * pacer->totalDelayTicks / pacer->qpcFrequency / pacer->paced : 0.0,
+        pacer->paced ? 100.0 * pacer->deadlineMisses / pacer->paced : 0.0,
+        pacer->unpredicted,
+        1000.0 * (pacer->totalWorkTicks - pacer->totalGLTicks) / pacer->qpcFrequency / frames,
+        1000.0 * pacer->totalGLTicks / pacer->qpcFrequency / frames);
+    OutputDebugStringA(buf);
+
+    pacer->totalDelayTicks = 0;
+    pacer->totalWorkTicks = 0;
+    pacer->totalGLTicks = 0;
+    pacer->paced = 0;
+    pacer->unpredicted = 0;
+    pacer->deadlineMisses = 0;
+}
+
+// Tracks the damage of the last frames of a swap chain.
+// A swap chain that preserves its buffers hands out the buffer presented bufferCount frames ago,
+// so that buffer has to be repainted wherever any frame since then was damaged.
+struct DamageTracker
+{
+    DamageRegion history[DXGI_MAX_SWAP_CHAIN_BUFFERS];
+    // Buffers rendered to in turn. 1 if the strategy renders to its own texture and copies it.
+    UINT bufferCount;
+    // Whether a buffer keeps its contents when presented. Discard swap effects leave them undefined.
+    bool preserved;
+    UINT frame;
+    DamageRegion current;
+};
+
+// A buffer that was never presented changes the whole window, since nothing in it was shown before.
+// Without this, a frame whose passes report nothing would present a fresh buffer as unchanged.
+void BeginDamageFrame(DamageTracker* tracker, LONG width, LONG height)
+{
+    tracker->current.count = 0;
+    if (tracker->frame < tracker->bufferCount)
+    {
+        RECT full = { 0, 0, width, height };
+        AddDamage(&tracker->current, full, width, height);
+    }
+}
+
+// The region that has to be repainted in the current buffer for it to be up to date
+void GetRepaintRegion(const DamageTracker* tracker, LONG width, LONG height, DamageRegion* repaint)
+{
+    *repaint = tracker->current;
+
+    // Buffers that were never presented, or whose contents were discarded, have no valid content
+    if (!tracker->preserved || tracker->frame < tracker->bufferCount)
+    {
+        RECT full = { 0, 0, width, height };
+        AddDamage(repaint, full, width, height);
+        return;
+    }
+
+    for (UINT age = 1; age < tracker->bufferCount; age++)
+    {
+        const DamageRegion& past = tracker->history[(tracker->frame - age) % tracker->bufferCount];
+        for (UINT i = 0; i < past.count; i++)
+        {
+            AddDamage(repaint, past.rects[i], width, height);
+        }
+    }
+}
+
+void EndDamageFrame(DamageTracker* tracker)
+{
+    tracker->history[tracker->frame % tracker->bufferCount] = tracker->current;
+    tracker->frame++;
+}
+
+#ifdef DAMAGE_TRACKER_TEST
+bool RegionContains(const DamageRegion& region, const RECT& rect)
+{
+    for (UINT i = 0; i < region.count; i++)
+    {
+        const RECT& r = region.rects[i];
+        if (r.left <= rect.left && r.top <= rect.top && r.right >= rect.right && r.bottom >= rect.bottom)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RegionEquals(const DamageRegion& region, const RECT& rect)
+{
+    return region.count == 1 && memcmp(&region.rects[0], &rect, sizeof(rect)) == 0;
+}
+
+bool CheckDamage(bool passed, const char* what)
+{
+    if (!passed)
+    {
+        char buf[256];
+        sprintf_s(buf, "Damage tracker test failed: %s\n", what);
+        OutputDebugStringA(buf);
+    }
+    return passed;
+}
+
+// The rectangle math of AddDamage, GetRepaintRegion and EndDamageFrame, on a 100x100 surface
+bool TestDamageTracker()
+{
+    const LONG size = 100;
+    RECT full = { 0, 0, size, size };
+    bool passed = true;
+
+    DamageRegion region = {};
+    AddDamage(&region, RECT{ -10, -10, 20, 20 }, size, size);
+    AddDamage(&region, RECT{ 150, 0, 200, 10 }, size, size);
+    passed &= CheckDamage(RegionEquals(region, RECT{ 0, 0, 20, 20 }), "rectangles are clipped to the surface");
+
+    region = {};
+    AddDamage(&region, RECT{ 0, 0, 10, 10 }, size, size);
+    AddDamage(&region, RECT{ 30, 0, 40, 10 }, size, size);
+    AddDamage(&region, RECT{ 10, 0, 30, 10 }, size, size);
+    passed &= CheckDamage(RegionEquals(region, RECT{ 0, 0, 40, 10 }), "touching rectangles merge");
+
+    region = {};
+    AddDamageGL(&region, 0, 0, 50, 10, size, size);
+    passed &= CheckDamage(RegionEquals(region, RECT{ 0, 90, 50, 100 }), "GL rectangles are flipped");
+
+    // One more separate rectangle than fits, so two have to merge without losing any of them
+    region = {};
+    RECT separate[MAX_DIRTY_RECTS + 1];
+    for (int i = 0; i < MAX_DIRTY_RECTS + 1; i++)
+    {
+        separate[i] = RECT{ i * 10, i * 10, i * 10 + 5, i * 10 + 5 };
+        AddDamage(&region, separate[i], size, size);
+    }
+    bool covered = region.count == MAX_DIRTY_RECTS;
+    for (int i = 0; i < MAX_DIRTY_RECTS + 1; i++)
+    {
+        covered &= RegionContains(region, separate[i]);
+    }
+    passed &= CheckDamage(covered, "a full region merges and still covers every rectangle");
+
+    // Three preserved buffers: each is fresh until it was presented once, then it misses the two frames after it
+    DamageTracker tracker = {};
+    tracker.bufferCount = 3;
+    tracker.preserved = true;
+    DamageRegion repaint;
+    for (int frame = 0; frame < 3; frame++)
+    {
+        BeginDamageFrame(&tracker, size, size);
+        GetRepaintRegion(&tracker, size, size, &repaint);
+        passed &= CheckDamage(RegionEquals(tracker.current, full) && RegionEquals(repaint, full), "fresh buffers are damaged and repainted everywhere");
+        EndDamageFrame(&tracker);
+    }
+
+    RECT a = { 0, 0, 10, 10 };
+    RECT b = { 50, 50, 60, 60 };
+    BeginDamageFrame(&tracker, size, size);
+    AddDamage(&tracker.current, a, size, size);
+    GetRepaintRegion(&tracker, size, size, &repaint);
+    passed &= CheckDamage(RegionEquals(tracker.current, a) && RegionEquals(repaint, full), "the first reused buffer still missed fresh frames");
+    EndDamageFrame(&tracker);
+
+    BeginDamageFrame(&tracker, size, size);
+    AddDamage(&tracker.current, b, size, size);
+    EndDamageFrame(&tracker);
+
+    BeginDamageFrame(&tracker, size, size);
+    GetRepaintRegion(&tracker, size, size, &repaint);
+    passed &= CheckDamage(tracker.current.count == 0 && repaint.count == 2 && RegionContains(repaint, a) && RegionContains(repaint, b),
+        "a reused buffer repaints what the frames since it was presented damaged");
+    EndDamageFrame(&tracker);
+
+    BeginDamageFrame(&tracker, size, size);
+    GetRepaintRegion(&tracker, size, size, &repaint);
+    passed &= CheckDamage(RegionEquals(repaint, b), "damage older than the buffer count is forgotten");
+    EndDamageFrame(&tracker);
+
+    // Discarded buffers are repainted everywhere, but only the first frames damage the window
+    tracker = {};
+    tracker.bufferCount = 2;
+    tracker.preserved = false;
+    for (int frame = 0; frame < 3; frame++)
+    {
+        BeginDamageFrame(&tracker, size, size);
+        GetRepaintRegion(&tracker, size, size, &repaint);
+        passed &= CheckDamage(RegionEquals(repaint, full) && (frame < 2 ? RegionEquals(tracker.current, full) : tracker.current.count == 0),
+            "discarded buffers are repainted everywhere");
+        EndDamageFrame(&tracker);
+    }
+
+    return passed;
+}
+#endif
+
+// What occlusion saved, since the last report
+struct OcclusionStats
+{
+    unsigned skippedFrames;       // frames where every output was occluded
+    unsigned skippedOutputFrames; // output frames not rendered
+    unsigned testPresents;
+    double sleptMs;
+};
+
+// A window with its own swap chain and render targets
+struct OutputWindow
+{
+    HWND hWnd;
+    IDXGISwapChain *swapChain;
+    IDXGISwapChain1 *swapChain1; // NULL if the runtime doesn't support Present1
+    HANDLE hFrameLatencyWaitableObject; // NULL unless the swap chain uses a flip model
+
+    DamageTracker damage;
+    // What has to be repainted in the current color buffer this frame
+    DamageRegion repaint;
+    PresentMonitor presentMonitor;
+
+    // Samples per pixel of the shared color and depth buffers. Above 1, the color buffer is resolved into the backbuffer.
+    UINT sampleCount;
+    const ColorFormat* colorFormat;
+    const DepthFormat* depthFormat;
+
+    // Occluded outputs aren't rendered, locked or presented, only test-presented every OCCLUDED_TEST_INTERVAL_MS
+    bool occluded;
+    // Whether the output is rendered this frame
+    bool active;
+    LARGE_INTEGER lastOcclusionTest;
+
+    ID3D11Texture2D *dxDepthBuffer;
+    ID3D11DepthStencilView *depthBufferView;
+    GLuint dsvNameGL;
+    HANDLE dsvHandleGL;
+
+    GLuint fbo;
+
+    // Color buffer rendered by both APIs and copied to the backbuffer, if the strategy copies
+    ID3D11Texture2D *dxOffscreenColorBuffer;
+
+    // Current backbuffer, acquired every frame unless USE_PERSISTENT_FRAME_OBJECTS is defined
+    ID3D11Texture2D *dxColorBuffer;
+
+    // View and registration of the color buffer both APIs render to.
+    // That's the backbuffer itself, unless the strategy copies.
+    ID3D11RenderTargetView *colorBufferView;
+    GLuint rtvNameGL;
+    HANDLE rtvHandleGL;
+};
+
+// Fetch the output's current backbuffer. Unless the strategy copies, also create its RTV, register it with GL and attach it to the output's FBO
+HRESULT AcquireBackbuffer(OutputWindow& output, const InteropStrategy& strategy, ID3D11Device* device, HANDLE gl_handleD3D)
+{
+    // Fetch the current swapchain backbuffer from the FLIP swap chain
+    HRESULT hr = output.swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID *)&output.dxColorBuffer);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    CountComAlloc();
+
+    if (strategy.copyToBackbuffer)
+    {
+        return S_OK;
+    }
+
+    // Create RTV for swapchain backbuffer
+    hr = device->CreateRenderTargetView(
+        output.dxColorBuffer,
+        &CD3D11_RENDER_TARGET_VIEW_DESC(D3D11_RTV_DIMENSION_TEXTURE2D, output.colorFormat->format),
+        &output.colorBufferView);
+    if (FAILED(hr))
+    {
+        output.dxColorBuffer->Release();
+        output.dxColorBuffer = NULL;
+        return hr;
+    }
+    CountComAlloc();
+
+    // register current backbuffer
+    output.rtvHandleGL = wglDXRegisterObjectNV(gl_handleD3D, output.dxColorBuffer, output.rtvNameGL, strategy.registrationTarget, WGL_ACCESS_READ_WRITE_NV);
+    if (output.rtvHandleGL == NULL)
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        output.colorBufferView->Release();
+        output.colorBufferView = NULL;
+        output.dxColorBuffer->Release();
+        output.dxColorBuffer = NULL;
+        return hr;
+    }
+    CountComAlloc();
+
+    // Attach Direct3D color buffer to FBO. It stays bound, since the frame loop binds it next anyway.
+    BindFramebufferGL(output.fbo);
+    AttachObjectGL(GL_COLOR_ATTACHMENT0, strategy.registrationTarget, output.rtvNameGL);
+
+    // Check framebuffer status in order to expose any errors (there are some, despite no apparent side-effects?)
+    LogFramebufferStatusGL(glCheckFramebufferStatus(GL_FRAMEBUFFER));
+
+    return S_OK;
+}
+
+// Release the output's current backbuffer back to the swap chain
+void ReleaseBackbuffer(OutputWindow& output, const InteropStrategy& strategy, HANDLE gl_handleD3D)
+{
+    if (!strategy.copyToBackbuffer)
+    {
+        wglDXUnregisterObjectNV(gl_handleD3D, output.rtvHandleGL);
+        output.colorBufferView->Release();
+    }
+    output.dxColorBuffer->Release();
+}
+
+// A thread that records D3D commands into its own deferred context
+struct RecordWorker
+{
+    HANDLE startEvent;
+    HANDLE doneEvent;
+    int index;
+    ID3D11DeviceContext* context;
+    D3DStateTracker tracker;
+
+    // One list per output and chunk, NULL for outputs that aren't active
+    ID3D11CommandList* commandLists[NUM_OUTPUT_WINDOWS][BENCHMARK_API_SWITCHES];
+
+    // Since the last report
+    LONGLONG recordTicks;
+};
+
+struct RecordWorkers
+{
+    RecordWorker workers[MAX_RECORD_WORKERS];
+    int count;
+
+    // What the workers record, set before they're started
+    BenchmarkScene* scene;
+    OutputWindow* outputs;
+};
+
+static RecordWorkers g_recordWorkers;
+
+// The objects of a D3D chunk that a worker records
+void GetRecordSlice(const BenchmarkScene* scene, int chunk, int worker, int workerCount, int* first, int* last)
+{
+    int d3dCount = scene->d3dObjectCount;
+    int chunkFirst = d3dCount * chunk / BENCHMARK_API_SWITCHES;
+    int chunkSize = d3dCount * (chunk + 1) / BENCHMARK_API_SWITCHES - chunkFirst;
+    *first = chunkFirst + chunkSize * worker / workerCount;
+    *last = chunkFirst + chunkSize * (worker + 1) / workerCount;
+}
+
+void RecordWorkerMain(RecordWorker* worker)
+{
+    D3D11_VIEWPORT viewport = CD3D11_VIEWPORT(0.0f, 0.0f, (float)SCREEN_WIDTH, (float)SCREEN_HEIGHT);
+
+    for (;;)
+    {
+        CheckWin32(WaitForSingleObject(worker->startEvent, INFINITE) == WAIT_OBJECT_0);
+
+        LARGE_INTEGER recordStart;
+        QueryPerformanceCounter(&recordStart);
+
+        BenchmarkScene* scene = g_recordWorkers.scene;
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+        {
+            const OutputWindow& output = g_recordWorkers.outputs[i];
+            for (int chunk = 0; chunk < BENCHMARK_API_SWITCHES; chunk++)
+            {
+                if (!output.active)
+                {
+                    worker->commandLists[i][chunk] = NULL;
+                    continue;
+                }
+
+                // Finishing a command list resets the deferred context, so every list sets up its own state
+                SetRenderTargetD3D(&worker->tracker, output.colorBufferView, output.depthBufferView);
+                SetViewportD3D(&worker->tracker, viewport);
+
+                int first, last;
+                GetRecordSlice(scene, chunk, worker->index, g_recordWorkers.count, &first, &last);
+                DrawBenchmarkObjectsD3D(scene, &worker->tracker, first, last);
+
+                // Not counted: a command list per chunk every frame is what deferred contexts are, not a leak of the loop
+                CheckHR(worker->context->FinishCommandList(FALSE, &worker->commandLists[i][chunk]));
+                InitD3DStateTracker(&worker->tracker, worker->context);
+            }
+        }
+
+        LARGE_INTEGER recordEnd;
+        QueryPerformanceCounter(&recordEnd);
+        worker->recordTicks += recordEnd.QuadPart - recordStart.QuadPart;
+
+        SetEvent(worker->doneEvent);
+    }
+}
+
+// The workers run until the process exits
+void InitRecordWorkers(RecordWorkers* workers, ID3D11Device* device)
+{
+    unsigned hardwareThreads = std::thread::hardware_concurrency();
+    workers->count = hardwareThreads == 0 ? 1 : hardwareThreads > MAX_RECORD_WORKERS ? MAX_RECORD_WORKERS : (int)hardwareThreads;
+
+    for (int i = 0; i < workers->count; i++)
+    {
+        RecordWorker* worker = &workers->workers[i];
+        worker->index = i;
+        worker->startEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        worker->doneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        CheckWin32(worker->startEvent != NULL && worker->doneEvent != NULL);
+        CheckHR(device->CreateDeferredContext(0, &worker->context));
+        InitD3DStateTracker(&worker->tracker, worker->context);
+        std::thread(RecordWorkerMain, worker).detach();
+    }
+}
+
+// Start recording the frame's D3D chunks. The outputs' views must stay alive until WaitForRecordWorkers returns.
+void StartRecordWorkers(RecordWorkers* workers, BenchmarkScene* scene, OutputWindow* outputs)
+{
+    workers->scene = scene;
+    workers->outputs = outputs;
+    for (int i = 0; i < workers->count; i++)
+    {
+        SetEvent(workers->workers[i].startEvent);
+    }
+}
+
+void WaitForRecordWorkers(RecordWorkers* workers)
+{
+    HANDLE doneEvents[MAX_RECORD_WORKERS];
+    for (int i = 0; i < workers->count; i++)
+    {
+        doneEvents[i] = workers->workers[i].doneEvent;
+    }
+    CheckWin32(WaitForMultipleObjects(workers->count, doneEvents, TRUE, INFINITE) < WAIT_OBJECT_0 + workers->count);
+}
+
+// Draw the scene into an output whose buffers D3D currently owns, alternating APIs BENCHMARK_API_SWITCHES times.
+// If the record workers are running, the D3D chunks come from their command lists instead of being drawn here.
+void DrawBenchmarkScene(BenchmarkScene* scene, OutputWindow& output, int outputIndex, D3DStateTracker* tracker, HANDLE gl_handleD3D)
+{
+    HANDLE lockHandlesGL[] = { output.dsvHandleGL, output.rtvHandleGL };
+
+    SetRenderTargetD3D(tracker, output.colorBufferView, output.depthBufferView);
+    for (int chunk = 0; chunk < BENCHMARK_API_SWITCHES; chunk++)
+    {
+        int d3dFirst = scene->d3dChunks[chunk].first;
+        int d3dLast = scene->d3dChunks[chunk].last;
+        if (g_recordWorkers.count > 0)
+        {
+            // Executing without restoring state leaves the immediate context cleared
+            for (int w = 0; w < g_recordWorkers.count; w++)
+            {
+                ID3D11CommandList*& commandList = g_recordWorkers.workers[w].commandLists[outputIndex][chunk];
+                tracker->context->ExecuteCommandList(commandList, FALSE);
+                commandList->Release();
+                commandList = NULL;
+            }
+            InitD3DStateTracker(tracker, tracker->context);
+        }
+        else
+        {
+            DrawBenchmarkObjectsD3D(scene, tracker, d3dFirst, d3dLast);
+        }
+        scene->drawCalls += d3dLast - d3dFirst;
+
+        // The handoff is what the benchmark measures, the GL draws in between aren't counted
+        LARGE_INTEGER lockStart, lockEnd, unlockStart, unlockEnd;
+        QueryPerformanceCounter(&lockStart);
+        wglDXLockObjectsNV(gl_handleD3D, _countof(lockHandlesGL), lockHandlesGL);
+        BindFramebufferGL(output.fbo);
+        QueryPerformanceCounter(&lockEnd);
+
+        DrawBenchmarkObjectsGL(scene, scene->glChunks[chunk].first, scene->glChunks[chunk].last);
+
+        QueryPerformanceCounter(&unlockStart);
+        wglDXUnlockObjectsNV(gl_handleD3D, _countof(lockHandlesGL), lockHandlesGL);
+        QueryPerformanceCounter(&unlockEnd);
+
+        scene->apiSwitches++;
+        scene->apiSwitchTicks += (lockEnd.QuadPart - lockStart.QuadPart) + (unlockEnd.QuadPart - unlockStart.QuadPart);
+    }
+}
+
+// Copy the offscreen color buffer into the backbuffer, resolving it if it's multisampled
+void CopyToBackbuffer(ID3D11DeviceContext* devCtx, const OutputWindow& output)
+{
+    if (output.sampleCount > 1)
+    {
+        devCtx->ResolveSubresource(output.dxColorBuffer, 0, output.dxOffscreenColorBuffer, 0, output.colorFormat->format);
+    }
+    else
+    {
+        devCtx->CopyResource(output.dxColorBuffer, output.dxOffscreenColorBuffer);
+    }
+}
+
+// Formats other than sRGB need the swap chain's color space set to match, or DXGI presents them as sRGB.
+// HDR color spaces are only supported by flip model swap chains, on displays that have HDR enabled.
+void SetSwapChainColorSpace(IDXGISwapChain* swapChain, const ColorFormat& format)
+{
+    IDXGISwapChain3* swapChain3;
+    if (FAILED(swapChain->QueryInterface(&swapChain3)))
+    {
+        OutputDebugStringA("IDXGISwapChain3 isn't supported, so the swap chain keeps the sRGB color space\n");
+        return;
+    }
+
+    UINT support = 0;
+    if (SUCCEEDED(swapChain3->CheckColorSpaceSupport(format.colorSpace, &support)) && (support & DXGI_SWAP_CHAIN_COLOR_SPACE_SUPPORT_FLAG_PRESENT))
+    {
+        CheckHR(swapChain3->SetColorSpace1(format.colorSpace));
+    }
+    else
+    {
+        char buf[128];
+        sprintf_s(buf, "The color space of %s can't be presented, so the swap chain keeps the sRGB color space\n", format.name);
+        OutputDebugStringA(buf);
+    }
+    swapChain3->Release();
+}
+
+// Create the swap chain and render targets of a window
+HRESULT CreateOutput(OutputWindow& output, HWND hWnd, const InteropStrategy& strategy, UINT sampleCount, const ColorFormat& colorFormat, const DepthFormat& depthFormat, bool allowTearing, IDXGIFactory* dxgiFactory, ID3D11Device* device, HANDLE gl_handleD3D)
+{
+    assert(IsStrategyUsable(strategy, sampleCount));
+    output.hWnd = hWnd;
+    output.sampleCount = sampleCount;
+    output.colorFormat = &colorFormat;
+    output.depthFormat = &depthFormat;
+
+    // create swap chain
+    DXGI_SWAP_CHAIN_DESC scd = {};
+    scd.BufferDesc.Format = colorFormat.format;
+    scd.SampleDesc.Count = 1;
+    scd.BufferCount = DXGI_MAX_SWAP_CHAIN_BUFFERS; // TODO: This is a stress test. Should be set to a reasonable value instead, otherwise you'll get lots of latency.
+    scd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+    scd.OutputWindow = hWnd;
+    scd.Windowed = TRUE;
+    scd.SwapEffect = strategy.swapEffect;
+    if (IsFlipModel(strategy.swapEffect))
+    {
+        scd.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+    }
+    if (allowTearing)
+    {
+        scd.Flags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
+    }
+
+    HRESULT hr = dxgiFactory->CreateSwapChain(device, &scd, &output.swapChain);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    if (FAILED(output.swapChain->QueryInterface(&output.swapChain1)))
+    {
+        output.swapChain1 = NULL;
+    }
+    if (colorFormat.colorSpace != DXGI_COLOR_SPACE_RGB_FULL_G22_NONE_P709)
+    {
+        SetSwapChainColorSpace(output.swapChain, colorFormat);
+    }
+    // The offscreen color buffer of a copying strategy is the only one rendered to, and it's never discarded
+    output.damage.bufferCount = strategy.copyToBackbuffer ? 1 : scd.BufferCount;
+    output.damage.preserved = strategy.copyToBackbuffer || strategy.swapEffect == DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
+
+    if (IsFlipModel(strategy.swapEffect))
+    {
+        // get frame latency waitable object
+        IDXGISwapChain2* swapChain2;
+        CheckHR(output.swapChain->QueryInterface(&swapChain2));
+        output.hFrameLatencyWaitableObject = swapChain2->GetFrameLatencyWaitableObject();
+        swapChain2->Release();
+    }
+
+    // Create depth stencil texture
+    CheckHR(device->CreateTexture2D(
+        &CD3D11_TEXTURE2D_DESC(depthFormat.textureFormat, SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1, D3D11_BIND_DEPTH_STENCIL, D3D11_USAGE_DEFAULT, 0, sampleCount),
+        NULL,
+        &output.dxDepthBuffer));
+
+    // Create depth stencil view
+    CheckHR(device->CreateDepthStencilView(
+        output.dxDepthBuffer,
+        &CD3D11_DEPTH_STENCIL_VIEW_DESC(sampleCount > 1 ? D3D11_DSV_DIMENSION_TEXTURE2DMS : D3D11_DSV_DIMENSION_TEXTURE2D, depthFormat.viewFormat),
+        &output.depthBufferView));
+
+    // register the Direct3D depth/stencil buffer in opengl
+    output.dsvNameGL = GenObjectGL(strategy.registrationTarget);
+
+    output.dsvHandleGL = wglDXRegisterObjectNV(gl_handleD3D, output.dxDepthBuffer, output.dsvNameGL, strategy.registrationTarget, WGL_ACCESS_READ_WRITE_NV);
+    if (output.dsvHandleGL == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Initialize GL FBO
+    glGenFramebuffers(1, &output.fbo);
+
+    // attach the Direct3D depth buffer to FBO
+    BindFramebufferGL(output.fbo);
+    AttachObjectGL(DepthAttachmentGL(depthFormat), strategy.registrationTarget, output.dsvNameGL);
+
+    // GL RTV will be recreated every frame to use the FLIP swap chain
+    output.rtvNameGL = GenObjectGL(strategy.registrationTarget);
+
+    if (strategy.copyToBackbuffer)
+    {
+        // Create the offscreen color buffer, and register it once since it never changes
+        CheckHR(device->CreateTexture2D(
+            &CD3D11_TEXTURE2D_DESC(colorFormat.format, SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1, D3D11_BIND_RENDER_TARGET, D3D11_USAGE_DEFAULT, 0, sampleCount),
+            NULL,
+            &output.dxOffscreenColorBuffer));
+
+        CheckHR(device->CreateRenderTargetView(
+            output.dxOffscreenColorBuffer,
+            &CD3D11_RENDER_TARGET_VIEW_DESC(sampleCount > 1 ? D3D11_RTV_DIMENSION_TEXTURE2DMS : D3D11_RTV_DIMENSION_TEXTURE2D, colorFormat.format),
+            &output.colorBufferView));
+
+        output.rtvHandleGL = wglDXRegisterObjectNV(gl_handleD3D, output.dxOffscreenColorBuffer, output.rtvNameGL, strategy.registrationTarget, WGL_ACCESS_READ_WRITE_NV);
+        if (output.rtvHandleGL == NULL)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        BindFramebufferGL(output.fbo);
+        AttachObjectGL(GL_COLOR_ATTACHMENT0, strategy.registrationTarget, output.rtvNameGL);
+        LogFramebufferStatusGL(glCheckFramebufferStatus(GL_FRAMEBUFFER));
+    }
+
+#ifdef USE_PERSISTENT_FRAME_OBJECTS
+    // Acquire the backbuffer once. D3D11 keeps buffer 0 pointing at the current backbuffer across presents.
+    hr = AcquireBackbuffer(output, strategy, device, gl_handleD3D);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+#endif
+
+    return S_OK;
+}
+
+// Release everything CreateOutput created, including after a partial failure
+void DestroyOutput(OutputWindow& output, const InteropStrategy& strategy, HANDLE gl_handleD3D)
+{
+#ifdef USE_PERSISTENT_FRAME_OBJECTS
+    if (output.dxColorBuffer)
+    {
+        ReleaseBackbuffer(output, strategy, gl_handleD3D);
+    }
+#endif
+
+    if (strategy.copyToBackbuffer)
+    {
+        if (output.rtvHandleGL) wglDXUnregisterObjectNV(gl_handleD3D, output.rtvHandleGL);
+        if (output.colorBufferView) output.colorBufferView->Release();
+        if (output.dxOffscreenColorBuffer) output.dxOffscreenColorBuffer->Release();
+    }
+    if (output.rtvNameGL) DeleteObjectGL(strategy.registrationTarget, output.rtvNameGL);
+    if (output.fbo) DeleteFramebufferGL(output.fbo);
+    if (output.dsvHandleGL) wglDXUnregisterObjectNV(gl_handleD3D, output.dsvHandleGL);
+    if (output.dsvNameGL) DeleteObjectGL(strategy.registrationTarget, output.dsvNameGL);
+    if (output.depthBufferView) output.depthBufferView->Release();
+    if (output.dxDepthBuffer) output.dxDepthBuffer->Release();
+    if (output.swapChain1) output.swapChain1->Release();
+    if (output.swapChain) output.swapChain->Release();
+    if (output.hFrameLatencyWaitableObject) CloseHandle(output.hFrameLatencyWaitableObject);
+
+    output = {};
+}
+
+// Reads back one texel of a texture and compares it to an RGBA8 color
+bool CheckTexel(ID3D11Device* device, ID3D11DeviceContext* devCtx, ID3D11Texture2D* texture, UINT x, UINT y, const float expected[4])
+{
+    ID3D11Texture2D *staging;
+    CheckHR(device->CreateTexture2D(
+        &CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R8G8B8A8_UNORM, 1, 1, 1, 1, 0, D3D11_USAGE_STAGING, D3D11_CPU_ACCESS_READ),
+        NULL,
+        &staging));
+
+    D3D11_BOX box = { x, y, 0, x + 1, y + 1, 1 };
+    devCtx->CopySubresourceRegion(staging, 0, 0, 0, 0, texture, 0, &box);
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    CheckHR(devCtx->Map(staging, 0, D3D11_MAP_READ, 0, &mapped));
+    const unsigned char* texel = (const unsigned char*)mapped.pData;
+    bool matches = true;
+    for (int c = 0; c < 4; c++)
+    {
+        int expectedByte = (int)(expected[c] * 255.0f + 0.5f);
+        if (abs(texel[c] - expectedByte) > 1)
+        {
+            matches = false;
+        }
+    }
+    devCtx->Unmap(staging, 0);
+    staging->Release();
+
+    return matches;
+}
+
+// Render the depth scene into offscreen buffers shared with GL, with the given depth format and registration target,
+// and check every sample pixel. Fails if the format can't be a depth buffer, registered or attached.
+bool VerifySharedDepth(const DepthScene& scene, const DepthFormat& format, GLenum registrationTarget, ID3D11Device* device, ID3D11DeviceContext* devCtx, HANDLE gl_handleD3D)
+{
+    UINT support = 0;
+    if (FAILED(device->CheckFormatSupport(format.viewFormat, &support)) || !(support & D3D11_FORMAT_SUPPORT_DEPTH_STENCIL))
+    {
+        return false;
+    }
+
+    ID3D11Texture2D* colorBuffer;
+    ID3D11RenderTargetView* colorBufferView;
+    CheckHR(device->CreateTexture2D(
+        &CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R8G8B8A8_UNORM, SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1, D3D11_BIND_RENDER_TARGET),
+        NULL,
+        &colorBuffer));
+    CheckHR(device->CreateRenderTargetView(
+        colorBuffer,
+        &CD3D11_RENDER_TARGET_VIEW_DESC(D3D11_RTV_DIMENSION_TEXTURE2D, DXGI_FORMAT_R8G8B8A8_UNORM),
+        &colorBufferView));
+
+    ID3D11Texture2D* depthBuffer;
+    ID3D11DepthStencilView* depthBufferView;
+    CheckHR(device->CreateTexture2D(
+        &CD3D11_TEXTURE2D_DESC(format.textureFormat, SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1, D3D11_BIND_DEPTH_STENCIL),
+        NULL,
+        &depthBuffer));
+    CheckHR(device->CreateDepthStencilView(
+        depthBuffer,
+        &CD3D11_DEPTH_STENCIL_VIEW_DESC(D3D11_DSV_DIMENSION_TEXTURE2D, format.viewFormat),
+        &depthBufferView));
+
+    GLuint colorNameGL = GenObjectGL(registrationTarget);
+    GLuint depthNameGL = GenObjectGL(registrationTarget);
+    HANDLE colorHandleGL = wglDXRegisterObjectNV(gl_handleD3D, colorBuffer, colorNameGL, registrationTarget, WGL_ACCESS_READ_WRITE_NV);
+    HANDLE depthHandleGL = wglDXRegisterObjectNV(gl_handleD3D, depthBuffer, depthNameGL, registrationTarget, WGL_ACCESS_READ_WRITE_NV);
+    bool works = colorHandleGL != NULL && depthHandleGL != NULL;
+
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    if (works)
+    {
+        BindFramebufferGL(fbo);
+        AttachObjectGL(GL_COLOR_ATTACHMENT0, registrationTarget, colorNameGL);
+        AttachObjectGL(DepthAttachmentGL(format), registrationTarget, depthNameGL);
+        works = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    }
+
+    if (works)
+    {
+        D3DStateTracker tracker = {};
+        InitD3DStateTracker(&tracker, devCtx);
+        SetRenderTargetD3D(&tracker, colorBufferView, depthBufferView);
+        SetViewportD3D(&tracker, CD3D11_VIEWPORT(0.0f, 0.0f, (float)SCREEN_WIDTH, (float)SCREEN_HEIGHT));
+
+        // Depth is only ever cleared by D3D
+        float clearColor[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        devCtx->ClearRenderTargetView(colorBufferView, clearColor);
+        devCtx->ClearDepthStencilView(depthBufferView, DepthClearFlags(format), 1.0f, 0);
+        DrawDepthScene(scene, DEPTH_SCENE_D3D_BEFORE_GL, &tracker);
+
+        HANDLE lockHandlesGL[] = { colorHandleGL, depthHandleGL };
+        wglDXLockObjectsNV(gl_handleD3D, _countof(lockHandlesGL), lockHandlesGL);
+        BindFramebufferGL(fbo);
+        SetViewportGL(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        DrawDepthScene(scene, DEPTH_SCENE_GL, NULL);
+        wglDXUnlockObjectsNV(gl_handleD3D, _countof(lockHandlesGL), lockHandlesGL);
+
+        DrawDepthScene(scene, DEPTH_SCENE_D3D_AFTER_GL, &tracker);
+
+        for (int i = 0; i < (int)_countof(g_depthSceneSamples); i++)
+        {
+            const DepthSceneSample& sample = g_depthSceneSamples[i];
+            UINT x = (UINT)((sample.x + 1.0f) * 0.5f * SCREEN_WIDTH);
+            UINT y = (UINT)((1.0f - sample.y) * 0.5f * SCREEN_HEIGHT);
+            if (!CheckTexel(device, devCtx, colorBuffer, x, y, sample.color))
+            {
+                char buf[128];
+                sprintf_s(buf, "Depth format %s: wrong color at pixel (%u, %u)\n", format.name, x, y);
+                OutputDebugStringA(buf);
+                works = false;
+            }
+        }
+    }
+
+    // The main loop's state tracker assumes a cleared context
+    devCtx->ClearState();
+
+    DeleteFramebufferGL(fbo);
+    if (depthHandleGL) wglDXUnregisterObjectNV(gl_handleD3D, depthHandleGL);
+    if (colorHandleGL) wglDXUnregisterObjectNV(gl_handleD3D, colorHandleGL);
+    DeleteObjectGL(registrationTarget, depthNameGL);
+    DeleteObjectGL(registrationTarget, colorNameGL);
+    depthBufferView->Release();
+    depthBuffer->Release();
+    colorBufferView->Release();
+    colorBuffer->Release();
+
+    return works;
+}
+
+// Pick the cheapest depth format that can be shared and passes VerifySharedDepth
+// The check is single sampled. ChooseSampleCount lowers the sample count to what the chosen format supports afterwards,
+// rather than a format being skipped for not supporting the requested count.
+int NegotiateDepthFormat(const DepthScene& scene, GLenum registrationTarget, ID3D11Device* device, ID3D11DeviceContext* devCtx, HANDLE gl_handleD3D)
+{
+    for (int i = 0; i < (int)_countof(g_depthFormats); i++)
+    {
+        const DepthFormat& format = g_depthFormats[i];
+        bool works = VerifySharedDepth(scene, format, registrationTarget, device, devCtx, gl_handleD3D);
+
+        char buf[128];
+        sprintf_s(buf, "Depth format %s (%u bytes per pixel): %s\n", format.name, format.bytesPerPixel, works ? "works" : "doesn't work");
+        OutputDebugStringA(buf);
+
+        if (works)
+        {
+            return i;
+        }
+    }
+
+    OutputDebugStringA("No depth format passed the shared depth test, falling back to D32_FLOAT_S8X24_UINT\n");
+    return FALLBACK_DEPTH_FORMAT;
+}
+
+// Check that a color format can be rendered to and displayed by D3D, and that a buffer of it can be registered,
+// locked and rendered to by GL. Some drivers fail registration for some of the formats D3D supports.
+// The buffer is an offscreen texture, so the outputs are still created with a fallback in case a swap chain buffer fails.
+// Like the depth check it's single sampled, and the sample count is lowered to what the chosen format supports afterwards.
+bool ProbeColorFormat(const ColorFormat& format, GLenum registrationTarget, ID3D11Device* device, HANDLE gl_handleD3D)
+{
+    UINT support = 0;
+    UINT required = D3D11_FORMAT_SUPPORT_RENDER_TARGET | D3D11_FORMAT_SUPPORT_DISPLAY;
+    if (FAILED(device->CheckFormatSupport(format.format, &support)) || (support & required) != required)
+    {
+        return false;
+    }
+
+    // Cheaper than registering, and catches drivers that can't render to the matching GL format at all
+    GLint renderable = GL_NONE;
+    glGetInternalformativ(registrationTarget, format.internalFormatGL, GL_FRAMEBUFFER_RENDERABLE, 1, &renderable);
+    if (renderable != GL_FULL_SUPPORT)
+    {
+        return false;
+    }
+
+    ID3D11Texture2D* colorBuffer;
+    CheckHR(device->CreateTexture2D(
+        &CD3D11_TEXTURE2D_DESC(format.format, SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1, D3D11_BIND_RENDER_TARGET),
+        NULL,
+        &colorBuffer));
+
+    GLuint colorNameGL = GenObjectGL(registrationTarget);
+    HANDLE colorHandleGL = wglDXRegisterObjectNV(gl_handleD3D, colorBuffer, colorNameGL, registrationTarget, WGL_ACCESS_READ_WRITE_NV);
+    bool works = colorHandleGL != NULL;
+
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    if (works)
+    {
+        works = wglDXLockObjectsNV(gl_handleD3D, 1, &colorHandleGL) != FALSE;
+    }
+    if (works)
+    {
+        BindFramebufferGL(fbo);
+        AttachObjectGL(GL_COLOR_ATTACHMENT0, registrationTarget, colorNameGL);
+        works = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (works)
+        {
+            SetEnabledGL(GL_SCISSOR_TEST, false);
+            SetClearColorGL(0.0f, 0.0f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        works = wglDXUnlockObjectsNV(gl_handleD3D, 1, &colorHandleGL) != FALSE && works;
+    }
+
+    DeleteFramebufferGL(fbo);
+    if (colorHandleGL) wglDXUnregisterObjectNV(gl_handleD3D, colorHandleGL);
+    DeleteObjectGL(registrationTarget, colorNameGL);
+    colorBuffer->Release();
+
+    return works;
+}
+
+// Use the requested color format if it can be shared, probing it unless the profile already knows.
+// R8G8B8A8_UNORM is used otherwise, since the interop strategy was probed with it.
+int ChooseColorFormat(StartupProfile* profile, int requested, GLenum registrationTarget, ID3D11Device* device, HANDLE gl_handleD3D, bool* probed)
+{
+    int bit = 1 << requested;
+    *probed = !(profile->colorFormatsProbed & bit);
+    if (*probed)
+    {
+        bool works = requested == COLOR_FORMAT_RGBA8 || ProbeColorFormat(g_colorFormats[requested], registrationTarget, device, gl_handleD3D);
+        profile->colorFormatsProbed |= bit;
+        profile->colorFormatsWorking = works ? profile->colorFormatsWorking | bit : profile->colorFormatsWorking & ~bit;
+
+        char buf[128];
+        sprintf_s(buf, "Color format %s: %s\n", g_colorFormats[requested].name, works ? "works" : "doesn't work");
+        OutputDebugStringA(buf);
+    }
+
+    if (profile->colorFormatsWorking & bit)
+    {
+        return requested;
+    }
+
+    char buf[128];
+    sprintf_s(buf, "Color format %s can't be shared, falling back to R8G8B8A8_UNORM\n", g_colorFormats[requested].name);
+    OutputDebugStringA(buf);
+    return COLOR_FORMAT_RGBA8;
+}
+
+// Render a few frames with a strategy in a temporary window, checking that GL's rendering lands in the backbuffer,
+// then time a few more. Returns the average time per timed frame, or a negative number if the strategy doesn't work.
+double ProbeInteropStrategy(const InteropStrategy& strategy, UINT sampleCount, HINSTANCE hInstance, IDXGIFactory* dxgiFactory, ID3D11Device* device, ID3D11DeviceContext* devCtx, HANDLE gl_handleD3D)
+{
+    // The window must be visible, otherwise presents are occluded and the swap chain never cycles through its buffers.
+    // A fresh window is used for every strategy, since a window can't go back to a bitblt swap chain after using a flip one.
+    HWND hWnd = CreateWindowEx(0, TEXT("WindowClass"), TEXT("Probing"), WS_POPUP | WS_VISIBLE, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, NULL, NULL, hInstance, NULL);
+    CheckWin32(hWnd != NULL);
+
+    OutputWindow output = {};
+    bool works = SUCCEEDED(CreateOutput(output, hWnd, strategy, sampleCount, g_colorFormats[COLOR_FORMAT_RGBA8], g_depthFormats[FALLBACK_DEPTH_FORMAT], false, dxgiFactory, device, gl_handleD3D));
+
+    ID3D11Query *frameQuery;
+    CheckHR(device->CreateQuery(&CD3D11_QUERY_DESC(D3D11_QUERY_EVENT), &frameQuery));
+
+    LARGE_INTEGER probeStart = {};
+    for (int frame = 0; works && frame < PROBE_FRAMES + PROBE_TIMED_FRAMES; frame++)
+    {
+        // The timed frames start once the GPU is done with the checked ones
+        if (frame == PROBE_FRAMES)
+        {
+            devCtx->End(frameQuery);
+            while (devCtx->GetData(frameQuery, NULL, 0, 0) == S_FALSE)
+            {
+                SwitchToThread();
+            }
+            QueryPerformanceCounter(&probeStart);
+        }
+
+        if (output.hFrameLatencyWaitableObject)
+        {
+            WaitForSingleObject(output.hFrameLatencyWaitableObject, INFINITE);
+        }
+
+#ifndef USE_PERSISTENT_FRAME_OBJECTS
+        if (FAILED(AcquireBackbuffer(output, strategy, device, gl_handleD3D)))
+        {
+            works = false;
+            break;
+        }
+#endif
+
+        // D3D clears everything, then GL clears the left half like the main loop
+        float dxClearColor[] = { 0.5f, 0.0f, 0.0f, 1.0f };
+        float glClearColorRGBA[] = { 0.0f, 0.5f, 0.0f, 1.0f };
+        devCtx->ClearRenderTargetView(output.colorBufferView, dxClearColor);
+
+        HANDLE lockHandlesGL[] = { output.dsvHandleGL, output.rtvHandleGL };
+        wglDXLockObjectsNV(gl_handleD3D, _countof(lockHandlesGL), lockHandlesGL);
+
+        BindFramebufferGL(output.fbo);
+        SetViewportGL(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        SetEnabledGL(GL_SCISSOR_TEST, true);
+        SetScissorGL(0, 0, SCREEN_WIDTH / 2, SCREEN_HEIGHT);
+        SetClearColorGL(glClearColorRGBA[0], glClearColorRGBA[1], glClearColorRGBA[2], glClearColorRGBA[3]);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        wglDXUnlockObjectsNV(gl_handleD3D, _countof(lockHandlesGL), lockHandlesGL);
+
+        if (strategy.copyToBackbuffer)
+        {
+            CopyToBackbuffer(devCtx, output);
+        }
+
+        // The last buffers of the cycle are the ones that break on some drivers, so check those
+        if (frame >= PROBE_FRAMES - DXGI_MAX_SWAP_CHAIN_BUFFERS && frame < PROBE_FRAMES &&
+            !CheckTexel(device, devCtx, output.dxColorBuffer, 0, 0, glClearColorRGBA))
+        {
+            works = false;
+        }
+
+        if (FAILED(output.swapChain->Present(0, 0)))
+        {
+            works = false;
+        }
+
+#ifndef USE_PERSISTENT_FRAME_OBJECTS
+        ReleaseBackbuffer(output, strategy, gl_handleD3D);
+        output.dxColorBuffer = NULL;
+#endif
+    }
+
+    // Wait for the GPU to finish the timed frames
+    devCtx->End(frameQuery);
+    while (works && devCtx->GetData(frameQuery, NULL, 0, 0) == S_FALSE)
+    {
+        SwitchToThread();
+    }
+
+    LARGE_INTEGER probeEnd;
+    QueryPerformanceCounter(&probeEnd);
+
+    frameQuery->Release();
+    DestroyOutput(output, strategy, gl_handleD3D);
+    DestroyWindow(hWnd);
+
+    char buf[256];
+    if (works)
+    {
+        sprintf_s(buf, "Interop strategy %s: works, %.3f ms per frame\n", strategy.name, ElapsedMs(probeStart, probeEnd) / PROBE_TIMED_FRAMES);
+    }
+    else
+    {
+        sprintf_s(buf, "Interop strategy %s: doesn't work\n", strategy.name);
+    }
+    OutputDebugStringA(buf);
+
+    return works ? ElapsedMs(probeStart, probeEnd) / PROBE_TIMED_FRAMES : -1.0;
+}
+
+// Time ResolveSubresource at every sample count the shared formats support, to show what MSAA costs per frame
+void BenchmarkResolve(const ColorFormat& colorFormat, const DepthFormat& depthFormat, ID3D11Device* device, ID3D11DeviceContext* devCtx)
+{
+    ID3D11Texture2D* resolved;
+    CheckHR(device->CreateTexture2D(
+        &CD3D11_TEXTURE2D_DESC(colorFormat.format, SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1, D3D11_BIND_RENDER_TARGET),
+        NULL,
+        &resolved));
+
+    ID3D11Query* disjointQuery;
+    ID3D11Query* startQuery;
+    ID3D11Query* endQuery;
+    CheckHR(device->CreateQuery(&CD3D11_QUERY_DESC(D3D11_QUERY_TIMESTAMP_DISJOINT), &disjointQuery));
+    CheckHR(device->CreateQuery(&CD3D11_QUERY_DESC(D3D11_QUERY_TIMESTAMP), &startQuery));
+    CheckHR(device->CreateQuery(&CD3D11_QUERY_DESC(D3D11_QUERY_TIMESTAMP), &endQuery));
+
+    for (UINT sampleCount = 2; sampleCount <= D3D11_MAX_MULTISAMPLE_SAMPLE_COUNT; sampleCount *= 2)
+    {
+        if (ChooseSampleCount(device, sampleCount, colorFormat, depthFormat) != sampleCount)
+        {
+            continue;
+        }
+
+        ID3D11Texture2D* multisampled;
+        CheckHR(device->CreateTexture2D(
+            &CD3D11_TEXTURE2D_DESC(colorFormat.format, SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1, D3D11_BIND_RENDER_TARGET, D3D11_USAGE_DEFAULT, 0, sampleCount),
+            NULL,
+            &multisampled));
+
+        devCtx->Begin(disjointQuery);
+        devCtx->End(startQuery);
+        for (int i = 0; i < RESOLVE_BENCHMARK_ITERATIONS; i++)
+        {
+            devCtx->ResolveSubresource(resolved, 0, multisampled, 0, colorFormat.format);
+        }
+        devCtx->End(endQuery);
+        devCtx->End(disjointQuery);
+
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+        UINT64 start, end;
+        while (devCtx->GetData(disjointQuery, &disjoint, sizeof(disjoint), 0) == S_FALSE)
+        {
+            SwitchToThread();
+        }
+        CheckHR(devCtx->GetData(startQuery, &start, sizeof(start), 0));
+        CheckHR(devCtx->GetData(endQuery, &end, sizeof(end), 0));
+
+        char buf[128];
+        if (disjoint.Disjoint)
+        {
+            sprintf_s(buf, "%ux MSAA resolve: timer was disjoint\n", sampleCount);
+        }
+        else
+        {
+            sprintf_s(buf, "%ux MSAA resolve: %.3f ms\n", sampleCount, 1000.0 * (end - start) / disjoint.Frequency / RESOLVE_BENCHMARK_ITERATIONS);
+        }
+        OutputDebugStringA(buf);
+
+        multisampled->Release();
+    }
+
+    endQuery->Release();
+    startQuery->Release();
+    disjointQuery->Release();
+    resolved->Release();
+}
+
+// Probe every strategy and pick the fastest one that works
+int ChooseInteropStrategy(UINT sampleCount, HINSTANCE hInstance, IDXGIFactory* dxgiFactory, ID3D11Device* device, ID3D11DeviceContext* devCtx, HANDLE gl_handleD3D)
+{
+    int bestStrategy = -1;
+    double bestFrameMs = 0.0;
+    for (int i = 0; i < (int)_countof(g_interopStrategies); i++)
+    {
+        if (!IsStrategyUsable(g_interopStrategies[i], sampleCount))
+        {
+            continue;
+        }
+
+        double frameMs = ProbeInteropStrategy(g_interopStrategies[i], sampleCount, hInstance, dxgiFactory, device, devCtx, gl_handleD3D);
+        if (frameMs >= 0.0 && (bestStrategy == -1 || frameMs < bestFrameMs))
+        {
+            bestStrategy = i;
+            bestFrameMs = frameMs;
+        }
+    }
+
+    if (bestStrategy == -1)
+    {
+        OutputDebugStringA("No interop strategy passed the probe, falling back to copying\n");
+        bestStrategy = sampleCount > 1 ? FALLBACK_MSAA_INTEROP_STRATEGY : FALLBACK_INTEROP_STRATEGY;
+    }
+
+    return bestStrategy;
+}
+
+int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
+{
+    LARGE_INTEGER startupStart;
+    QueryPerformanceCounter(&startupStart);
+
+#ifdef _DEBUG
+    _CrtSetAllocHook(CountAllocHook);
+#endif
+
+#ifdef DAMAGE_TRACKER_TEST
+    CheckHR(TestDamageTracker() ? S_OK : E_FAIL);
+#endif
+
+    // Load the decisions made by a previous run, if any
+    StartupProfile profile;
+    bool warmStart = LoadStartupProfile(STARTUP_PROFILE_PATH, &profile);
+
+    // Register window class
+    WNDCLASSEX wc = {};
+    wc.cbSize = sizeof(wc);
+    wc.style = CS_OWNDC;
+    wc.lpfnWndProc = WndProc;
+    wc.hInstance = GetModuleHandleW(NULL);
+    wc.hCursor = LoadCursorW(NULL, IDC_ARROW);
+    wc.lpszClassName = TEXT("WindowClass");
+    CheckWin32(RegisterClassExW(&wc) != NULL);
+
+    // Determine size of window based on window style
+    DWORD dwStyle = WS_OVERLAPPEDWINDOW;
+    DWORD dwExStyle = 0;
+    RECT wr = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+    CheckWin32(AdjustWindowRectEx(&wr, dwStyle, FALSE, dwExStyle) != FALSE);
+
+    TCHAR* title = TEXT("OpenGL on DXGI");
+
+    OutputWindow outputs[NUM_OUTPUT_WINDOWS] = {};
+    for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+    {
+        // Create window
+        HWND hWnd = CreateWindowEx(
+            dwExStyle, TEXT("WindowClass"), title, dwStyle,
+            CW_USEDEFAULT, CW_USEDEFAULT,
+            wr.right - wr.left, wr.bottom - wr.top,
+            NULL, NULL, hInstance, NULL);
+        CheckWin32(hWnd != NULL);
+
+        // Unhide the window
+        ShowWindow(hWnd, SW_SHOWDEFAULT);
+
+        outputs[i].hWnd = hWnd;
+    }
+
+    LARGE_INTEGER windowsCreated;
+    QueryPerformanceCounter(&windowsCreated);
+
+    // create D3D11 device and context on another thread, overlapped with creating the GL context
+    ID3D11Device *device;
+    ID3D11DeviceContext *devCtx;
+    double d3dDeviceMs;
+
+    std::thread d3dDeviceThread([&] {
+        LARGE_INTEGER d3dStart;
+        QueryPerformanceCounter(&d3dStart);
+
+        UINT flags = 0;
+#if _DEBUG
+        flags |= D3D11_CREATE_DEVICE_DEBUG;
+#endif
+
+        CheckHR(D3D11CreateDevice(NULL, // pAdapter
+            D3D_DRIVER_TYPE_HARDWARE,   // DriverType
+            NULL,                       // Software
+            flags,                      // Flags (Do not set D3D11_CREATE_DEVICE_SINGLETHREADED)
+            NULL,                       // pFeatureLevels
+            0,                          // FeatureLevels
+            D3D11_SDK_VERSION,          // SDKVersion
+            &device,                    // ppDevice
+            NULL,                       // pFeatureLevel
+            &devCtx));                  // ppImmediateContext
+
+        // Map the shader pack while GL is still starting, shaders are only created once passes request them
+        InitShaderLoaderD3D(&g_shaderLoader, device);
+
+        LARGE_INTEGER d3dEnd;
+        QueryPerformanceCounter(&d3dEnd);
+        d3dDeviceMs = ElapsedMs(d3dStart, d3dEnd);
+    });
+
+    // Create window that will be used to create a GL context
+    HWND gl_hWnd = CreateWindowEx(0, TEXT("WindowClass"), 0, 0, 0, 0, 0, 0, 0, 0, hInstance, 0);
+    CheckWin32(gl_hWnd != NULL);
+
+    HDC gl_hDC = GetDC(gl_hWnd);
+    CheckWin32(gl_hDC != NULL);
+
+    // set pixelformat for window that supports OpenGL.
+    // The profile's pixel format is reused if it still supports OpenGL, which skips ChoosePixelFormat's enumeration.
+    PIXELFORMATDESCRIPTOR gl_pfd = {};
+    int chosenPixelFormat = profile.pixelFormat;
+    if (chosenPixelFormat == 0 ||
+        DescribePixelFormat(gl_hDC, chosenPixelFormat, sizeof(gl_pfd), &gl_pfd) == 0 ||
+        !(gl_pfd.dwFlags & PFD_SUPPORT_OPENGL))
+    {
+        gl_pfd = {};
+        gl_pfd.nSize = sizeof(gl_pfd);
+        gl_pfd.nVersion = 1;
+        gl_pfd.dwFlags = PFD_SUPPORT_OPENGL;
+
+        chosenPixelFormat = ChoosePixelFormat(gl_hDC, &gl_pfd);
+        profile.pixelFormat = chosenPixelFormat;
+    }
+    CheckWin32(SetPixelFormat(gl_hDC, chosenPixelFormat, &gl_pfd) != FALSE);
+
+    // Create dummy GL context that will be used to create the real context.
+    // It can't be skipped even on a warm start: wglGetProcAddress needs a current context.
+    HGLRC dummy_hGLRC = wglCreateContext(gl_hDC);
+    CheckWin32(dummy_hGLRC != NULL);
+
+    // Use the dummy context to get function to create a better context
+    CheckWin32(wglMakeCurrent(gl_hDC, dummy_hGLRC) != FALSE);
+
+    PFNWGLCREATECONTEXTATTRIBSARBPROC wglCreateContextAttribsARB = (PFNWGLCREATECONTEXTATTRIBSARBPROC)wglGetProcAddress("wglCreateContextAttribsARB");
+
+    int contextFlagsGL = 0;
+#ifdef _DEBUG
+    contextFlagsGL |= WGL_CONTEXT_DEBUG_BIT_ARB;
+#endif
+
+    int contextAttribsGL[] = {
+        WGL_CONTEXT_MAJOR_VERSION_ARB, profile.contextMajorVersion,
+        WGL_CONTEXT_MINOR_VERSION_ARB, profile.contextMinorVersion,
+        WGL_CONTEXT_FLAGS_ARB, contextFlagsGL,
+        WGL_CONTEXT_PROFILE_MASK_ARB, profile.contextProfileMask,
+        0
+    };
+
+    HGLRC hGLRC = wglCreateContextAttribsARB(gl_hDC, NULL, contextAttribsGL);
+    CheckWin32(hGLRC != NULL);
+
+    // Switch to the new context and ditch the old one
+    CheckWin32(wglMakeCurrent(gl_hDC, hGLRC) != FALSE);
+    CheckWin32(wglDeleteContext(dummy_hGLRC) != FALSE);
+
+    LARGE_INTEGER contextCreated;
+    QueryPerformanceCounter(&contextCreated);
+
+    // Grab WGL functions
+    wglDXOpenDeviceNV = (PFNWGLDXOPENDEVICENVPROC)wglGetProcAddress("wglDXOpenDeviceNV");
+    wglDXRegisterObjectNV = (PFNWGLDXREGISTEROBJECTNVPROC)wglGetProcAddress("wglDXRegisterObjectNV");
+    wglDXUnregisterObjectNV = (PFNWGLDXUNREGISTEROBJECTNVPROC)wglGetProcAddress("wglDXUnregisterObjectNV");
+    wglDXLockObjectsNV = (PFNWGLDXLOCKOBJECTSNVPROC)wglGetProcAddress("wglDXLockObjectsNV");
+    wglDXUnlockObjectsNV = (PFNWGLDXUNLOCKOBJECTSNVPROC)wglGetProcAddress("wglDXUnlockObjectsNV");
+
+    // Fall back to GetProcAddress to get GL 1 functions. wglGetProcAddress returns NULL on those.
+    HMODULE hOpenGL32 = LoadLibrary(TEXT("OpenGL32.dll"));
+
+    // Grab OpenGL functions
+    glEnable = (PFNGLENABLEPROC)GetProcAddress(hOpenGL32, "glEnable");
+    glDisable = (PFNGLDISABLEPROC)GetProcAddress(hOpenGL32, "glDisable");
+    glClear = (PFNGLCLEARPROC)GetProcAddress(hOpenGL32, "glClear");
+    glClearColor = (PFNGLCLEARCOLORPROC)GetProcAddress(hOpenGL32, "glClearColor");
+    glScissor = (PFNGLSCISSORPROC)GetProcAddress(hOpenGL32, "glScissor");
+    glViewport = (PFNGLVIEWPORTPROC)GetProcAddress(hOpenGL32, "glViewport");
+    glDrawArrays = (PFNGLDRAWARRAYSPROC)GetProcAddress(hOpenGL32, "glDrawArrays");
+    glGetIntegerv = (PFNGLGETINTEGERVPROC)GetProcAddress(hOpenGL32, "glGetIntegerv");
+    glGenTextures = (PFNGLGENTEXTURESPROC)GetProcAddress(hOpenGL32, "glGenTextures");
+    glBindTexture = (PFNGLBINDTEXTUREPROC)GetProcAddress(hOpenGL32, "glBindTexture");
+    glTexParameteri = (PFNGLTEXPARAMETERIPROC)GetProcAddress(hOpenGL32, "glTexParameteri");
+    glDeleteTextures = (PFNGLDELETETEXTURESPROC)GetProcAddress(hOpenGL32, "glDeleteTextures");
+    glGetString = (PFNGLGETSTRINGPROC)GetProcAddress(hOpenGL32, "glGetString");
+    glGenFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)wglGetProcAddress("glGenFramebuffers");
+    glDeleteFramebuffers = (PFNGLDELETEFRAMEBUFFERSPROC)wglGetProcAddress("glDeleteFramebuffers");
+    glBindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC)wglGetProcAddress("glBindFramebuffer");
+    glFramebufferTexture2D = (PFNGLFRAMEBUFFERTEXTURE2DPROC)wglGetProcAddress("glFramebufferTexture2D");
+    glGenRenderbuffers = (PFNGLGENRENDERBUFFERSPROC)wglGetProcAddress("glGenRenderbuffers");
+    glDeleteRenderbuffers = (PFNGLDELETERENDERBUFFERSPROC)wglGetProcAddress("glDeleteRenderbuffers");
+    glFramebufferRenderbuffer = (PFNGLFRAMEBUFFERRENDERBUFFERPROC)wglGetProcAddress("glFramebufferRenderbuffer");
+    glCheckFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)wglGetProcAddress("glCheckFramebufferStatus");
+    glGetInternalformativ = (PFNGLGETINTERNALFORMATIVPROC)wglGetProcAddress("glGetInternalformativ");
+    glCreateShader = (PFNGLCREATESHADERPROC)wglGetProcAddress("glCreateShader");
+    glDeleteShader = (PFNGLDELETESHADERPROC)wglGetProcAddress("glDeleteShader");
+    glShaderSource = (PFNGLSHADERSOURCEPROC)wglGetProcAddress("glShaderSource");
+    glCompileShader = (PFNGLCOMPILESHADERPROC)wglGetProcAddress("glCompileShader");
+    glGetShaderiv = (PFNGLGETSHADERIVPROC)wglGetProcAddress("glGetShaderiv");
+    glGetShaderInfoLog = (PFNGLGETSHADERINFOLOGPROC)wglGetProcAddress("glGetShaderInfoLog");
+    glCreateProgram = (PFNGLCREATEPROGRAMPROC)wglGetProcAddress("glCreateProgram");
+    glAttachShader = (PFNGLATTACHSHADERPROC)wglGetProcAddress("glAttachShader");
+    glLinkProgram = (PFNGLLINKPROGRAMPROC)wglGetProcAddress("glLinkProgram");
+    glGetProgramiv = (PFNGLGETPROGRAMIVPROC)wglGetProcAddress("glGetProgramiv");
+    glGetProgramInfoLog = (PFNGLGETPROGRAMINFOLOGPROC)wglGetProcAddress("glGetProgramInfoLog");
+    glDeleteProgram = (PFNGLDELETEPROGRAMPROC)wglGetProcAddress("glDeleteProgram");
+    glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)wglGetProcAddress("glProgramParameteri");
+    glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)wglGetProcAddress("glGetProgramBinary");
+    glProgramBinary = (PFNGLPROGRAMBINARYPROC)wglGetProcAddress("glProgramBinary");
+    glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)wglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    if (!glMaxShaderCompilerThreadsKHR)
+    {
+        glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)wglGetProcAddress("glMaxShaderCompilerThreadsARB");
+    }
+    glGetStringi = (PFNGLGETSTRINGIPROC)wglGetProcAddress("glGetStringi");
+    glUseProgram = (PFNGLUSEPROGRAMPROC)wglGetProcAddress("glUseProgram");
+    glGetUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC)wglGetProcAddress("glGetUniformLocation");
+    glUniform1f = (PFNGLUNIFORM1FPROC)wglGetProcAddress("glUniform1f");
+    glUniform4fv = (PFNGLUNIFORM4FVPROC)wglGetProcAddress("glUniform4fv");
+    glGenVertexArrays = (PFNGLGENVERTEXARRAYSPROC)wglGetProcAddress("glGenVertexArrays");
+    glBindVertexArray = (PFNGLBINDVERTEXARRAYPROC)wglGetProcAddress("glBindVertexArray");
+    glDrawArraysInstanced = (PFNGLDRAWARRAYSINSTANCEDPROC)wglGetProcAddress("glDrawArraysInstanced");
+    glGenBuffers = (PFNGLGENBUFFERSPROC)wglGetProcAddress("glGenBuffers");
+    glBindBuffer = (PFNGLBINDBUFFERPROC)wglGetProcAddress("glBindBuffer");
+    glBindBufferRange = (PFNGLBINDBUFFERRANGEPROC)wglGetProcAddress("glBindBufferRange");
+    glBindBufferBase = (PFNGLBINDBUFFERBASEPROC)wglGetProcAddress("glBindBufferBase");
+    glDeleteBuffers = (PFNGLDELETEBUFFERSPROC)wglGetProcAddress("glDeleteBuffers");
+    glBufferStorage = (PFNGLBUFFERSTORAGEPROC)wglGetProcAddress("glBufferStorage");
+    glMapBufferRange = (PFNGLMAPBUFFERRANGEPROC)wglGetProcAddress("glMapBufferRange");
+    glVertexAttribIPointer = (PFNGLVERTEXATTRIBIPOINTERPROC)wglGetProcAddress("glVertexAttribIPointer");
+    glVertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORPROC)wglGetProcAddress("glVertexAttribDivisor");
+    glEnableVertexAttribArray = (PFNGLENABLEVERTEXATTRIBARRAYPROC)wglGetProcAddress("glEnableVertexAttribArray");
+    glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)wglGetProcAddress("glMultiDrawElementsIndirect");
+    glFenceSync = (PFNGLFENCESYNCPROC)wglGetProcAddress("glFenceSync");
+    glClientWaitSync = (PFNGLCLIENTWAITSYNCPROC)wglGetProcAddress("glClientWaitSync");
+    glDeleteSync = (PFNGLDELETESYNCPROC)wglGetProcAddress("glDeleteSync");
+    glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)wglGetProcAddress("glDispatchCompute");
+    glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)wglGetProcAddress("glMemoryBarrier");
+    glBindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)wglGetProcAddress("glBindImageTexture");
+
+    // Enable OpenGL debugging
+#ifdef _DEBUG
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    glEnable(GL_DEBUG_OUTPUT);
+    PFNGLDEBUGMESSAGECALLBACKPROC glDebugMessageCallback = (PFNGLDEBUGMESSAGECALLBACKPROC)wglGetProcAddress("glDebugMessageCallback");
+    glDebugMessageCallback(DebugCallbackGL, 0);
+#endif
+
+    // The rest of the profile is stale if the driver changed since it was recorded
+    char driverGL[256];
+    sprintf_s(driverGL, "%s / %s", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+    if (strcmp(driverGL, profile.driverGL) != 0)
+    {
+        warmStart = false;
+        strncpy_s(profile.driverGL, driverGL, _TRUNCATE);
+    }
+
+    // Probe for the interop extension, unless the profile already says it's there
+    if (!warmStart)
+    {
+        PFNWGLGETEXTENSIONSSTRINGARBPROC wglGetExtensionsStringARB = (PFNWGLGETEXTENSIONSSTRINGARBPROC)wglGetProcAddress("wglGetExtensionsStringARB");
+        const char* extensionsWGL = wglGetExtensionsStringARB ? wglGetExtensionsStringARB(gl_hDC) : "";
+        profile.interopSupported = strstr(extensionsWGL, "WGL_NV_DX_interop2") != NULL;
+    }
+    CheckHR(profile.interopSupported ? S_OK : E_NOINTERFACE);
+
+    LARGE_INTEGER functionsLoaded;
+    QueryPerformanceCounter(&functionsLoaded);
+
+    // Programs don't need the D3D device, so they're built while it's still being created
+    InitProgramCacheGL(&g_programCache, driverGL);
+    LoadProgramsGL(&g_programCache);
+
+    LARGE_INTEGER programsBuilt;
+    QueryPerformanceCounter(&programsBuilt);
+
+    char programsBuf[256];
+    sprintf_s(programsBuf, "GL programs: %u from the cache, %u compiled, %u failed, %u cached binaries rejected, %.2f ms (binaries %s, parallel compile %s)\n",
+        g_programCache.loaded,
+        g_programCache.compiled,
+        g_programCache.failed,
+        g_programCache.rejected,
+        ElapsedMs(functionsLoaded, programsBuilt),
+        g_programCache.binariesSupported ? "cached" : "unsupported",
+        g_programCache.parallelCompile ? "on" : "off");
+    OutputDebugStringA(programsBuf);
+
+    // Wait for the D3D11 device
+    d3dDeviceThread.join();
+
+    LARGE_INTEGER deviceJoined;
+    QueryPerformanceCounter(&deviceJoined);
+
+#ifdef USE_DIRTY_RECTS
+    // ClearView clears a list of rectangles, ClearRenderTargetView only the whole view
+    ID3D11DeviceContext1 *devCtx1;
+    CheckHR(devCtx->QueryInterface(&devCtx1));
+#endif
+
+    // Get the factory that created the device, to create a swap chain for each window
+    IDXGIDevice *dxgiDevice;
+    CheckHR(device->QueryInterface(&dxgiDevice));
+
+    IDXGIAdapter *dxgiAdapter;
+    CheckHR(dxgiDevice->GetAdapter(&dxgiAdapter));
+
+    IDXGIFactory *dxgiFactory;
+    CheckHR(dxgiAdapter->GetParent(__uuidof(IDXGIFactory), (void **)&dxgiFactory));
+    dxgiAdapter->Release();
+    dxgiDevice->Release();
 
-    UINT flags = 0;
-#if _DEBUG
-    flags |= D3D11_CREATE_DEVICE_DEBUG;
-#endif
-
-    CheckHR(D3D11CreateDeviceAndSwapChain(NULL, // pAdapter
-        D3D_DRIVER_TYPE_HARDWARE,               // DriverType
-        NULL,                                   // Software
-        flags,                                  // Flags (Do not set D3D11_CREATE_DEVICE_SINGLETHREADED)
-        NULL,                                   // pFeatureLevels
-        0,                                      // FeatureLevels
-        D3D11_SDK_VERSION,                      // SDKVersion
-        &scd,                                   // pSwapChainDesc
-        &swapChain,                             // ppSwapChain
-        &device,                                // ppDevice
-        NULL,                                   // pFeatureLevel
-        &devCtx));                              // ppImmediateContext
 
     // Register D3D11 device with GL
     HANDLE gl_handleD3D;
     gl_handleD3D = wglDXOpenDeviceNV(device);
     CheckWin32(gl_handleD3D != NULL);
 
-#ifdef USE_WIN10_SWAPCHAIN
-    // get frame latency waitable object
-    IDXGISwapChain2* swapChain2;
-    CheckHR(swapChain->QueryInterface(&swapChain2));
-    hFrameLatencyWaitableObject = swapChain2->GetFrameLatencyWaitableObject();
+    LARGE_INTEGER interopOpened;
+    QueryPerformanceCounter(&interopOpened);
+
+#ifdef FRAME_ARENA_BENCHMARK
+    BenchmarkFrameArena();
 #endif
+    InitFrameArena(&g_frameArena, device, devCtx);
 
-    // Create depth stencil texture
-    ID3D11Texture2D *dxDepthBuffer;
-    CheckHR(device->CreateTexture2D(
-        &CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R32G8X24_TYPELESS, SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1, D3D11_BIND_DEPTH_STENCIL),
-        NULL,
-        &dxDepthBuffer));
+#ifdef TEXTURE_PACK_BENCHMARK
+    BenchmarkTexturePack(device);
+#endif
 
-    // Create depth stencil view
-    ID3D11DepthStencilView *depthBufferView;
-    CheckHR(device->CreateDepthStencilView(
-        dxDepthBuffer,
-        &CD3D11_DEPTH_STENCIL_VIEW_DESC(D3D11_DSV_DIMENSION_TEXTURE2D, DXGI_FORMAT_D32_FLOAT_S8X24_UINT),
-        &depthBufferView));
+    // The strategy probe renders R8G8B8A8_UNORM with the fallback depth format, so it's probed with what those support.
+    // The count is lowered again once the shared formats are chosen. It's never raised, so the strategy stays usable.
+#ifdef MSAA_SAMPLE_COUNT
+    UINT probeSampleCount = ChooseSampleCount(device, MSAA_SAMPLE_COUNT, g_colorFormats[COLOR_FORMAT_RGBA8], g_depthFormats[FALLBACK_DEPTH_FORMAT]);
+#else
+    UINT probeSampleCount = 1;
+#endif
 
-    // register the Direct3D depth/stencil buffer as texture2d in opengl
-    GLuint dsvNameGL;
-    glGenTextures(1, &dsvNameGL);
+    // Probe for the fastest interop strategy that works, unless the profile already chose it
+    bool profileChanged = !warmStart;
+    if (!warmStart || profile.interopStrategy < 0 || profile.interopStrategy >= (int)_countof(g_interopStrategies) ||
+        !IsStrategyUsable(g_interopStrategies[profile.interopStrategy], probeSampleCount))
+    {
+        profile.interopStrategy = ChooseInteropStrategy(probeSampleCount, hInstance, dxgiFactory, device, devCtx, gl_handleD3D);
+        profileChanged = true;
+    }
+    const InteropStrategy& strategy = g_interopStrategies[profile.interopStrategy];
 
-    HANDLE dsvHandleGL = wglDXRegisterObjectNV(gl_handleD3D, dxDepthBuffer, dsvNameGL, GL_TEXTURE_2D, WGL_ACCESS_READ_WRITE_NV);
-    CheckWin32(dsvHandleGL != NULL);
+#ifdef SHARED_DEPTH_TEST
+    DepthScene depthScene = {};
+    InitDepthScene(&depthScene, device);
 
-    // Initialize GL FBO
-    GLuint fbo;
-    glGenFramebuffers(1, &fbo);
+    // The negotiated format depends on the registration target, so it's redone whenever the strategy is
+    if (profileChanged || profile.depthFormat < 0 || profile.depthFormat >= (int)_countof(g_depthFormats))
+    {
+        profile.depthFormat = NegotiateDepthFormat(depthScene, strategy.registrationTarget, device, devCtx, gl_handleD3D);
+        profileChanged = true;
+    }
+    const DepthFormat& depthFormat = g_depthFormats[profile.depthFormat];
+#else
+    const DepthFormat& depthFormat = g_depthFormats[FALLBACK_DEPTH_FORMAT];
+#endif
 
-    // attach the Direct3D depth buffer to FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, dsvNameGL, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Also probed again with every strategy, since support depends on the registration target
+    if (profileChanged)
+    {
+        profile.colorFormatsProbed = 0;
+        profile.colorFormatsWorking = 0;
+    }
+    bool colorFormatProbed;
+    const ColorFormat& colorFormat = g_colorFormats[ChooseColorFormat(&profile, COLOR_FORMAT, strategy.registrationTarget, device, gl_handleD3D, &colorFormatProbed)];
+    profileChanged = profileChanged || colorFormatProbed;
 
-    // GL RTV will be recreated every frame to use the FLIP swap chain
-    GLuint rtvNameGL;
-    glGenTextures(1, &rtvNameGL);
+    UINT sampleCount = ChooseSampleCount(device, probeSampleCount, colorFormat, depthFormat);
+#ifdef MSAA_SAMPLE_COUNT
+    BenchmarkResolve(colorFormat, depthFormat, device, devCtx);
+#endif
+
+    // Tearing needs a flip model swap chain that was created to allow it
+    bool vsync = PRESENT_MODE == PRESENT_MODE_VSYNC || PRESENT_MODE == PRESENT_MODE_PACED;
+    bool allowTearing = !vsync && IsFlipModel(strategy.swapEffect) && CheckTearingSupport(dxgiFactory);
+    UINT syncInterval = vsync ? 1 : 0;
+    UINT presentFlags = allowTearing ? DXGI_PRESENT_ALLOW_TEARING : 0;
+
+    FrameLimiter frameLimiter = {};
+    if (PRESENT_MODE == PRESENT_MODE_CAPPED)
+    {
+        InitFrameLimiter(&frameLimiter, CAPPED_FRAMES_PER_SECOND);
+    }
+    FramePacer framePacer = {};
+    if (PRESENT_MODE == PRESENT_MODE_PACED)
+    {
+        InitFramePacer(&framePacer);
+    }
+    // Spreads the presents of the outputs over the frame
+    HANDLE presentTimer = CreateHighResolutionTimer();
+
+    // The color format was probed with an offscreen texture, so a swap chain of it can still fail.
+    // Then every output falls back to R8G8B8A8_UNORM, which the strategy was probed with, and the profile remembers.
+    const ColorFormat* outputColorFormat = &colorFormat;
+    for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+    {
+        HRESULT hr = CreateOutput(outputs[i], outputs[i].hWnd, strategy, sampleCount, *outputColorFormat, depthFormat, allowTearing, dxgiFactory, device, gl_handleD3D);
+        if (FAILED(hr) && outputColorFormat != &g_colorFormats[COLOR_FORMAT_RGBA8])
+        {
+            char buf[128];
+            sprintf_s(buf, "Failed to create an output with color format %s, falling back to R8G8B8A8_UNORM\n", outputColorFormat->name);
+            OutputDebugStringA(buf);
+
+            for (int k = 0; k <= i; k++)
+            {
+                HWND hWnd = outputs[k].hWnd;
+                DestroyOutput(outputs[k], strategy, gl_handleD3D);
+                outputs[k].hWnd = hWnd;
+            }
+            // Released swap chains are only destroyed once the context lets go of them, and a window can't have two flip model ones
+            devCtx->ClearState();
+            devCtx->Flush();
+
+            profile.colorFormatsWorking &= ~(1 << COLOR_FORMAT);
+            profileChanged = true;
+            outputColorFormat = &g_colorFormats[COLOR_FORMAT_RGBA8];
+            sampleCount = ChooseSampleCount(device, probeSampleCount, *outputColorFormat, depthFormat);
+            i = -1;
+            continue;
+        }
+        CheckHR(hr);
+    }
+    dxgiFactory->Release();
+
+    // Pipeline state for the D3D pass. Every frame binds it, and the tracker filters it when nothing changed.
+    D3DStateTracker d3dState = {};
+    InitD3DStateTracker(&d3dState, devCtx);
+    ID3D11BlendState* opaqueBlendState = GetBlendState(&g_stateObjects, device, CD3D11_BLEND_DESC(D3D11_DEFAULT));
+    ID3D11RasterizerState* solidRasterizerState = GetRasterizerState(&g_stateObjects, device, CD3D11_RASTERIZER_DESC(D3D11_DEFAULT));
+    ID3D11DepthStencilState* depthTestState = GetDepthStencilState(&g_stateObjects, device, CD3D11_DEPTH_STENCIL_DESC(D3D11_DEFAULT));
+    const float blendFactor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    D3D11_VIEWPORT viewport = CD3D11_VIEWPORT(0.0f, 0.0f, (float)SCREEN_WIDTH, (float)SCREEN_HEIGHT);
+
+#ifdef USE_JOB_SYSTEM
+    BenchmarkJobSystem();
+    unsigned jobThreads = std::thread::hardware_concurrency();
+    InitJobSystem(&g_jobSystem, jobThreads == 0 ? 1 : jobThreads > MAX_JOB_THREADS ? MAX_JOB_THREADS : (int)jobThreads);
+    JobSystem* frameJobs = &g_jobSystem;
+#else
+    JobSystem* frameJobs = NULL;
+#endif
+
+#ifdef TEXTURE_STREAMING
+    InitTextureStreamer(&g_textureStreamer, device, devCtx, gl_handleD3D);
+#endif
+
+#ifdef COMPUTE_INTEROP
+    InitParticleSystem(&g_particles, device, gl_handleD3D);
+    BenchmarkComputeInterop(&g_particles, device, devCtx, gl_handleD3D);
+#endif
+
+#ifdef BENCHMARK_SCENE
+    InitBenchmarkScene(&g_benchmarkScene, device);
+#ifdef USE_DEFERRED_CONTEXTS
+    InitRecordWorkers(&g_recordWorkers, device);
+#endif
+#endif
+
+    // Everything in the profile worked, so remember it for the next start
+    if (profileChanged)
+    {
+        SaveStartupProfile(STARTUP_PROFILE_PATH, profile);
+    }
+
+    LARGE_INTEGER outputsCreated;
+    QueryPerformanceCounter(&outputsCreated);
+
+    LARGE_INTEGER qpcFrequency;
+    QueryPerformanceFrequency(&qpcFrequency);
+
+    // Input received during startup would only measure how long startup took
+    memset(&g_inputLatency, 0, sizeof(g_inputLatency));
+    g_inputLatency.qpcFrequency = qpcFrequency.QuadPart;
+
+    unsigned frameIndex = 0;
+    unsigned reportHeapAllocs = 0;
+    unsigned reportComAllocs = 0;
+    LONGLONG reportFrameTicks = 0;
+    double reportDirtyArea = 0.0;
+    double reportRepaintArea = 0.0;
+    OcclusionStats occlusionStats = {};
 
     // main loop
     while (true)
     {
+        LARGE_INTEGER frameStart;
+        QueryPerformanceCounter(&frameStart);
+
+        // Paced by the first visible output, the others present at the same vblanks
+        LARGE_INTEGER workStart = frameStart;
+        if (PRESENT_MODE == PRESENT_MODE_PACED)
+        {
+            for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+            {
+                if (!outputs[i].occluded)
+                {
+                    WaitForFrameDeadline(&framePacer, outputs[i].presentMonitor);
+                    QueryPerformanceCounter(&workStart);
+                    break;
+                }
+            }
+        }
+        // Spent waiting on the swap chains during the frame's work, which the pacer doesn't count as work
+        LONGLONG blockedTicks = 0;
+
+        unsigned frameHeapAllocsStart = g_allocCounters.heapAllocs;
+        unsigned frameComAllocsStart = g_allocCounters.comAllocs;
+
         // Handle all events
         MSG msg;
         while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
         {
+            if (msg.message == WM_QUIT)
+            {
+                // Shaders requested after the first frame were compiled since the pack was last written
+                SaveShaderPackD3D(&g_shaderLoader);
+                ExitProcess(0);
+            }
             TranslateMessage(&msg);
             DispatchMessage(&msg);
         }
+        TagInputEvents(&g_inputLatency, frameIndex);
+
+        // Occluded outputs only do a test present now and then, to find out when they're visible again
+        int activeOutputs = 0;
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+        {
+            OutputWindow& output = outputs[i];
+            if (output.occluded && ElapsedMs(output.lastOcclusionTest, frameStart) >= OCCLUDED_TEST_INTERVAL_MS)
+            {
+                output.lastOcclusionTest = frameStart;
+                occlusionStats.testPresents++;
+                if (output.swapChain->Present(0, DXGI_PRESENT_TEST) == S_OK && !IsIconic(output.hWnd))
+                {
+                    output.occluded = false;
+
+                    char buf[128];
+                    sprintf_s(buf, "Output %d is visible again\n", i);
+                    OutputDebugStringA(buf);
+                }
+            }
+
+            output.active = !output.occluded;
+            if (output.active)
+            {
+                activeOutputs++;
+            }
+            else
+            {
+                occlusionStats.skippedOutputFrames++;
+            }
+        }
+
+        // With nothing visible there's no interop work and nothing is locked, so just sleep until the next test
+        if (activeOutputs == 0)
+        {
+            occlusionStats.skippedFrames++;
+            occlusionStats.sleptMs += OCCLUDED_TEST_INTERVAL_MS;
+            Sleep(OCCLUDED_TEST_INTERVAL_MS);
+            continue;
+        }
+
+        BeginFrameArena(&g_frameArena);
+
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+        {
+            if (!outputs[i].active)
+            {
+                continue;
+            }
+
+            // Wait until the previous frame is presented before drawing the next frame
+            if (outputs[i].hFrameLatencyWaitableObject)
+            {
+                LARGE_INTEGER waitStart, waitEnd;
+                QueryPerformanceCounter(&waitStart);
+                CheckWin32(WaitForSingleObject(outputs[i].hFrameLatencyWaitableObject, INFINITE) == WAIT_OBJECT_0);
+                QueryPerformanceCounter(&waitEnd);
+                blockedTicks += waitEnd.QuadPart - waitStart.QuadPart;
+            }
+
+#ifndef USE_PERSISTENT_FRAME_OBJECTS
+            CheckHR(AcquireBackbuffer(outputs[i], strategy, device, gl_handleD3D));
+#endif
+        }
 
-#ifdef USE_WIN10_SWAPCHAIN
-        // Wait until the previous frame is presented before drawing the next frame
-        CheckWin32(WaitForSingleObject(hFrameLatencyWaitableObject, INFINITE) == WAIT_OBJECT_0);
+#ifdef BENCHMARK_SCENE
+        // Seconds since startup, since a float of the seconds since boot loses the precision the animation needs
+        BeginBenchmarkFrame(&g_benchmarkScene, (float)((double)(frameStart.QuadPart - startupStart.QuadPart) / qpcFrequency.QuadPart), frameJobs);
+#ifdef USE_DEFERRED_CONTEXTS
+        // Record the benchmark's D3D chunks while this thread does the rest of the frame
+        StartRecordWorkers(&g_recordWorkers, &g_benchmarkScene, outputs);
+#endif
 #endif
 
-        // Fetch the current swapchain backbuffer from the FLIP swap chain
-        ID3D11Texture2D *dxColorBuffer;
-        CheckHR(swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID *)&dxColorBuffer));
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+        {
+            if (!outputs[i].active)
+            {
+                continue;
+            }
 
-        // Create RTV for swapchain backbuffer
-        ID3D11RenderTargetView *colorBufferView;
-        CheckHR(device->CreateRenderTargetView(
-            dxColorBuffer,
-            &CD3D11_RENDER_TARGET_VIEW_DESC(D3D11_RTV_DIMENSION_TEXTURE2D, DXGI_FORMAT_R8G8B8A8_UNORM),
-            &colorBufferView));
+            // Animated passes report what they change before anything is drawn, since the clears have to cover it
+            BeginDamageFrame(&outputs[i].damage, SCREEN_WIDTH, SCREEN_HEIGHT);
+#ifdef TEXTURE_STREAMING
+            AddStreamedTextureDamage(&outputs[i].damage.current, SCREEN_WIDTH, SCREEN_HEIGHT);
+#endif
+#if defined(SHARED_DEPTH_TEST) || defined(BENCHMARK_SCENE) || defined(COMPUTE_INTEROP)
+            // These passes draw changing content over the whole window
+            RECT animatedRect = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+            AddDamage(&outputs[i].damage.current, animatedRect, SCREEN_WIDTH, SCREEN_HEIGHT);
+#endif
+#ifdef USE_DIRTY_RECTS
+            GetRepaintRegion(&outputs[i].damage, SCREEN_WIDTH, SCREEN_HEIGHT, &outputs[i].repaint);
+#else
+            RECT fullRect = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+            outputs[i].repaint.count = 0;
+            AddDamage(&outputs[i].repaint, fullRect, SCREEN_WIDTH, SCREEN_HEIGHT);
+#endif
+
+            // Attach back buffer and depth texture to redertarget for the device.
+            SetRenderTargetD3D(&d3dState, outputs[i].colorBufferView, outputs[i].depthBufferView);
+            SetViewportD3D(&d3dState, viewport);
+            SetBlendStateD3D(&d3dState, opaqueBlendState, blendFactor, 0xFFFFFFFF);
+            SetRasterizerStateD3D(&d3dState, solidRasterizerState);
+            SetDepthStencilStateD3D(&d3dState, depthTestState, 0);
+
+            // Direct3d renders to the render targets
+            // The demo's background doesn't change, so only the parts of the buffer that are out of date are cleared
+            float dxClearColor[] = { 0.5f, 0.0f, 0.0f, 1.0f };
+#ifdef USE_DIRTY_RECTS
+            // Restoring the background where the buffer missed frames isn't damage, the window already shows it there
+            if (outputs[i].repaint.count > 0)
+            {
+                devCtx1->ClearView(outputs[i].colorBufferView, dxClearColor, outputs[i].repaint.rects, outputs[i].repaint.count);
+            }
+#else
+            devCtx->ClearRenderTargetView(outputs[i].colorBufferView, dxClearColor);
+            RECT dxClearRect = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+            AddDamage(&outputs[i].damage.current, dxClearRect, SCREEN_WIDTH, SCREEN_HEIGHT);
+#endif
+#ifdef SHARED_DEPTH_TEST
+            // The only depth clear of the frame. GL and the second D3D pass test against what this pass writes.
+            devCtx->ClearDepthStencilView(outputs[i].depthBufferView, DepthClearFlags(*outputs[i].depthFormat), 1.0f, 0);
+            DrawDepthScene(depthScene, DEPTH_SCENE_D3D_BEFORE_GL, &d3dState);
+#endif
+        }
 
-        // register current backbuffer
-        HANDLE rtvHandleGL = wglDXRegisterObjectNV(gl_handleD3D, dxColorBuffer, rtvNameGL, GL_TEXTURE_2D, WGL_ACCESS_READ_WRITE_NV);
-        CheckWin32(rtvHandleGL != NULL);
+#ifdef TEXTURE_STREAMING
+        // Uploads are copied into the shared texture before it's locked, so none of them happen inside the lock window
+        UpdateTextureStreamer(&g_textureStreamer);
+#endif
 
-        // Attach Direct3D color buffer to FBO
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rtvNameGL, 0);
-        
-        // Check framebuffer status in order to expose any errors (there are some, despite no apparent side-effects?)
-        GLenum fbostatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-        if (fbostatus == GL_FRAMEBUFFER_COMPLETE)
+        // lock the dsv/rtv of every active output, and the resources GL writes this frame, for GL access in a single call
+        HANDLE* lockHandlesGL = AllocateInteropHandles(&g_frameArena, 2 * activeOutputs + 1 + MAX_COMPUTE_RESOURCES);
+        UINT lockCountGL = 0;
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
         {
-            OutputDebugStringA("Framebuffer complete\n");
+            if (outputs[i].active)
+            {
+                lockHandlesGL[lockCountGL++] = outputs[i].dsvHandleGL;
+                lockHandlesGL[lockCountGL++] = outputs[i].rtvHandleGL;
+            }
         }
-        else
-        {   
-            OutputDebugStringA("Framebuffer not complete: ");
-            const char* errmsg = NULL;
-            switch (fbostatus)
+#ifdef TEXTURE_STREAMING
+        lockHandlesGL[lockCountGL++] = g_textureStreamer.textureHandleGL;
+#endif
+#ifdef COMPUTE_INTEROP
+        for (int i = 0; i < g_particles.interop.count; i++)
+        {
+            lockHandlesGL[lockCountGL++] = g_particles.interop.handles[i];
+        }
+#endif
+        LARGE_INTEGER glLocked;
+        QueryPerformanceCounter(&glLocked);
+        wglDXLockObjectsNV(gl_handleD3D, lockCountGL, lockHandlesGL);
+
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+        {
+            if (!outputs[i].active)
             {
-            case GL_FRAMEBUFFER_COMPLETE: errmsg = "GL_FRAMEBUFFER_COMPLETE"; break;
-            case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT"; break;
-            case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT"; break;
-            case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER"; break;
-            case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER"; break;
-            case GL_FRAMEBUFFER_UNSUPPORTED: errmsg = "GL_FRAMEBUFFER_UNSUPPORTED"; break;
-            case GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE"; break;
-            case GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS: errmsg = "GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS"; break;
+                continue;
             }
-            if (errmsg)
+
+            // OpenGL renders to the render targets.
+            // State is set every frame but only reaches the driver when it changes, so nothing is reset afterwards.
+            BindFramebufferGL(outputs[i].fbo);
+            SetViewportGL(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+            // clear half the screen, so half the screen will be from DX and half from GL.
+            // Like the D3D clear, only the parts of that half that have to be repainted are cleared.
+            SetEnabledGL(GL_SCISSOR_TEST, true);
+            SetClearColorGL(0.0f, 0.5f, 0.0f, 1.0f);
+            for (UINT r = 0; r < outputs[i].repaint.count; r++)
             {
-                OutputDebugStringA(errmsg);
+                const RECT& rect = outputs[i].repaint.rects[r];
+                LONG right = rect.right < SCREEN_WIDTH / 2 ? rect.right : SCREEN_WIDTH / 2;
+                if (right > rect.left)
+                {
+                    SetScissorGL(rect.left, SCREEN_HEIGHT - rect.bottom, right - rect.left, rect.bottom - rect.top);
+                    glClear(GL_COLOR_BUFFER_BIT);
+                }
             }
-            OutputDebugStringA("\n");
+            SetScissorGL(0, 0, SCREEN_WIDTH / 2, SCREEN_HEIGHT);
+#ifndef USE_DIRTY_RECTS
+            AddDamageGL(&outputs[i].damage.current, 0, 0, SCREEN_WIDTH / 2, SCREEN_HEIGHT, SCREEN_WIDTH, SCREEN_HEIGHT);
+#endif
+#ifdef TEXTURE_STREAMING
+            DrawStreamedTextureGL(g_textureStreamer);
+#endif
+#ifdef SHARED_DEPTH_TEST
+            DrawDepthScene(depthScene, DEPTH_SCENE_GL, NULL);
+#endif
         }
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+#ifdef COMPUTE_INTEROP
+        DispatchParticlesGL(&g_particles, PARTICLE_TIME_STEP);
+#endif
 
-        // Attach back buffer and depth texture to redertarget for the device.
-        devCtx->OMSetRenderTargets(1, &colorBufferView, depthBufferView);
+        // unlock the dsv/rtv of every output
+        wglDXUnlockObjectsNV(gl_handleD3D, lockCountGL, lockHandlesGL);
+        LARGE_INTEGER glUnlocked;
+        QueryPerformanceCounter(&glUnlocked);
 
-        // Direct3d renders to the render targets
-        float dxClearColor[] = { 0.5f, 0.0f, 0.0f, 1.0f };
-        devCtx->ClearRenderTargetView(colorBufferView, dxClearColor);
-
-        // lock the dsv/rtv for GL access
-        wglDXLockObjectsNV(gl_handleD3D, 1, &dsvHandleGL);
-        wglDXLockObjectsNV(gl_handleD3D, 1, &rtvHandleGL);
-
-        // OpenGL renders to the render targets
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-        // clear half the screen, so half the screen will be from DX and half from GL
-        glEnable(GL_SCISSOR_TEST);
-        glScissor(0, 0, SCREEN_WIDTH / 2, SCREEN_HEIGHT);
-        glClearColor(0.0f, 0.5f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDisable(GL_SCISSOR_TEST);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+#ifdef SHARED_DEPTH_TEST
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+        {
+            if (outputs[i].active)
+            {
+                SetRenderTargetD3D(&d3dState, outputs[i].colorBufferView, outputs[i].depthBufferView);
+                DrawDepthScene(depthScene, DEPTH_SCENE_D3D_AFTER_GL, &d3dState);
+            }
+        }
+#endif
+
+#ifdef BENCHMARK_SCENE
+#ifdef USE_DEFERRED_CONTEXTS
+        WaitForRecordWorkers(&g_recordWorkers);
+#endif
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+        {
+            if (outputs[i].active)
+            {
+                DrawBenchmarkScene(&g_benchmarkScene, outputs[i], i, &d3dState, gl_handleD3D);
+            }
+        }
+        EndBenchmarkFrame(&g_benchmarkScene);
+#endif
+
+#ifdef COMPUTE_INTEROP
+        // Drawn last, since the particles don't test against depth
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+        {
+            if (outputs[i].active)
+            {
+                SetRenderTargetD3D(&d3dState, outputs[i].colorBufferView, outputs[i].depthBufferView);
+                DrawParticlesD3D(&g_particles, &d3dState);
+            }
+        }
+#endif
+
+        if (strategy.copyToBackbuffer)
+        {
+            for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+            {
+                if (outputs[i].active)
+                {
+                    CopyToBackbuffer(devCtx, outputs[i]);
+                }
+            }
+        }
+
+        // DXGI presents the results on the screen.
+        // The present order rotates by one output every frame, so no window is always presented last.
+        // The k-th output in that order presents about k / NUM_OUTPUT_WINDOWS of the frame budget after the work started,
+        // instead of all of them going out back to back. The budget is the time until the paced frame's vblank,
+        // the refresh period when presents wait for vblank, or the frame limiter's period.
+        // Immediate presents have no budget, and a present whose time already passed goes out right away.
+        LONGLONG presentBudgetTicks = 0;
+        if (PRESENT_MODE == PRESENT_MODE_PACED && framePacer.targetVblank > workStart.QuadPart)
+        {
+            presentBudgetTicks = framePacer.targetVblank - workStart.QuadPart;
+        }
+        else if (PRESENT_MODE == PRESENT_MODE_CAPPED)
+        {
+            presentBudgetTicks = frameLimiter.periodTicks;
+        }
+        else if (vsync)
+        {
+            for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+            {
+                if (outputs[i].active && outputs[i].presentMonitor.refreshPeriodTicks > 0.0)
+                {
+                    presentBudgetTicks = (LONGLONG)(outputs[i].presentMonitor.refreshPeriodTicks * syncInterval);
+                    break;
+                }
+            }
+        }
+
+        for (int k = 0; k < NUM_OUTPUT_WINDOWS; k++)
+        {
+            int i = (frameIndex + k) % NUM_OUTPUT_WINDOWS;
+            if (!outputs[i].active)
+            {
+                continue;
+            }
 
-        // TODO: Test that depth/stencil tests actually work by rendering some triangles with depth/stencil tests, mixing between GL and DX
+            DamageTracker& damage = outputs[i].damage;
+            for (UINT r = 0; r < damage.current.count; r++)
+            {
+                reportDirtyArea += RectArea(damage.current.rects[r]);
+            }
+            for (UINT r = 0; r < outputs[i].repaint.count; r++)
+            {
+                reportRepaintArea += RectArea(outputs[i].repaint.rects[r]);
+            }
+
+            // Counted from before the wait, so the pacer doesn't take the wait for work
+            LARGE_INTEGER presentStart;
+            QueryPerformanceCounter(&presentStart);
+            LONGLONG presentDeadline = workStart.QuadPart + presentBudgetTicks * k / NUM_OUTPUT_WINDOWS;
+            if (presentDeadline > presentStart.QuadPart)
+            {
+                SleepUntil(presentTimer, presentDeadline, qpcFrequency.QuadPart);
+            }
+
+            HRESULT presentResult;
+#ifdef USE_DIRTY_RECTS
+            if (outputs[i].swapChain1 && strategy.swapEffect == DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL)
+            {
+                // An empty list would mean the whole window changed, so a frame that changed nothing passes a single pixel
+                RECT unchangedRect = { 0, 0, 1, 1 };
+                DXGI_PRESENT_PARAMETERS presentParameters = {};
+                presentParameters.DirtyRectsCount = damage.current.count > 0 ? damage.current.count : 1;
+                presentParameters.pDirtyRects = damage.current.count > 0 ? damage.current.rects : &unchangedRect;
+                presentResult = outputs[i].swapChain1->Present1(syncInterval, presentFlags, &presentParameters);
+            }
+            else
+#endif
+            {
+                presentResult = outputs[i].swapChain->Present(syncInterval, presentFlags);
+            }
+            CheckHR(presentResult);
+
+            LARGE_INTEGER presented;
+            QueryPerformanceCounter(&presented);
+            blockedTicks += presented.QuadPart - presentStart.QuadPart;
+            PollPresentMonitor(&outputs[i].presentMonitor, outputs[i].swapChain, presented.QuadPart, syncInterval);
+
+            EndDamageFrame(&damage);
+
+            // Stop rendering the output until a test present says it's visible again
+            if (presentResult == DXGI_STATUS_OCCLUDED || IsIconic(outputs[i].hWnd))
+            {
+                outputs[i].occluded = true;
+                outputs[i].lastOcclusionTest = frameStart;
+                RestartPresentMonitor(&outputs[i].presentMonitor);
+
+                char buf[128];
+                sprintf_s(buf, "Output %d is occluded\n", i);
+                OutputDebugStringA(buf);
+            }
+        }
+
+        EndFrameArena(&g_frameArena);
+
+        // Input goes with the present of the first output that presented
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+        {
+            if (outputs[i].active)
+            {
+                const PresentMonitor& monitor = outputs[i].presentMonitor;
+                // The present count can't always be read, and then the record is an older frame's.
+                // The events stay unpresented until a later frame's present is recorded.
+                const PresentRecord& present = monitor.history[monitor.lastPresentCount % PRESENT_MONITOR_HISTORY];
+                if (present.presentCount == monitor.lastPresentCount && present.issuedTicks >= frameStart.QuadPart)
+                {
+                    PresentInputEvents(&g_inputLatency, present.presentCount, present.issuedTicks);
+                }
+                if (monitor.displayedTicks != 0)
+                {
+                    DisplayInputEvents(&g_inputLatency, monitor.displayedPresentCount, monitor.displayedTicks);
+                }
+                break;
+            }
+        }
+
+        if (PRESENT_MODE == PRESENT_MODE_PACED)
+        {
+            LARGE_INTEGER presented;
+            QueryPerformanceCounter(&presented);
+            EndPacedFrame(&framePacer, workStart.QuadPart, blockedTicks, glUnlocked.QuadPart - glLocked.QuadPart, presented.QuadPart);
+        }
+
+        if (frameIndex == 0)
+        {
+            LARGE_INTEGER firstFramePresented;
+            QueryPerformanceCounter(&firstFramePresented);
+
+            char buf[512];
+            sprintf_s(buf, "Startup (%s): windows %.2f ms, GL context %.2f ms, GL functions %.2f ms, GL programs %.2f ms, "
+                "D3D device %.2f ms (overlapped, waited %.2f ms), interop %.2f ms, outputs %.2f ms, "
+                "first frame %.2f ms, total %.2f ms\n",
+                warmStart ? "warm" : "cold",
+                ElapsedMs(startupStart, windowsCreated),
+                ElapsedMs(windowsCreated, contextCreated),
+                ElapsedMs(contextCreated, functionsLoaded),
+                ElapsedMs(functionsLoaded, programsBuilt),
+                d3dDeviceMs,
+                ElapsedMs(programsBuilt, deviceJoined),
+                ElapsedMs(deviceJoined, interopOpened),
+                ElapsedMs(interopOpened, outputsCreated),
+                ElapsedMs(outputsCreated, firstFramePresented),
+                ElapsedMs(startupStart, firstFramePresented));
+            OutputDebugStringA(buf);
+            sprintf_s(buf, "D3D shaders: %u from the pack, %d compiled, passes waited %.2f ms for them\n",
+                (unsigned)g_shaderLoader.loadedFromPack,
+                GetCompiledShaderCountD3D(&g_shaderLoader),
+                1000.0 * g_shaderLoader.waitTicks / qpcFrequency.QuadPart);
+            OutputDebugStringA(buf);
 
-        // unlock the dsv/rtv
-        wglDXUnlockObjectsNV(gl_handleD3D, 1, &dsvHandleGL);
-        wglDXUnlockObjectsNV(gl_handleD3D, 1, &rtvHandleGL);
+            // Only after the first frame, so writing it doesn't delay that
+            SaveShaderPackD3D(&g_shaderLoader);
+        }
+
+#ifndef USE_PERSISTENT_FRAME_OBJECTS
+        // release current backbuffers back to the swap chains
+        for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+        {
+            if (outputs[i].active)
+            {
+                ReleaseBackbuffer(outputs[i], strategy, gl_handleD3D);
+            }
+        }
+#endif
+
+        // Account for this frame's allocations
+        unsigned frameHeapAllocs = g_allocCounters.heapAllocs - frameHeapAllocsStart;
+        unsigned frameComAllocs = g_allocCounters.comAllocs - frameComAllocsStart;
+        reportHeapAllocs += frameHeapAllocs;
+        reportComAllocs += frameComAllocs;
+        frameIndex++;
 
-        // DXGI presents the results on the screen
-        CheckHR(swapChain->Present(0, 0));
+#ifdef USE_PERSISTENT_FRAME_OBJECTS
+        // Steady-state frames must not allocate anything
+        if (frameIndex > ALLOCATION_WARMUP_FRAMES && (frameHeapAllocs != 0 || frameComAllocs != 0))
+        {
+            char buf[128];
+            sprintf_s(buf, "Frame %u allocated: %u heap, %u COM\n", frameIndex, frameHeapAllocs, frameComAllocs);
+            OutputDebugStringA(buf);
+            CheckHR(E_FAIL);
+        }
+#endif
+
+        if (PRESENT_MODE == PRESENT_MODE_CAPPED)
+        {
+            WaitForNextFrame(&frameLimiter);
+        }
 
-        // release current backbuffer back to the swap chain
-        wglDXUnregisterObjectNV(gl_handleD3D, rtvHandleGL);
-        colorBufferView->Release();
-        dxColorBuffer->Release();
+        LARGE_INTEGER frameEnd;
+        QueryPerformanceCounter(&frameEnd);
+        reportFrameTicks += frameEnd.QuadPart - frameStart.QuadPart;
+
+        if (frameIndex % STATS_REPORT_FRAMES == 0)
+        {
+            char buf[256];
+            sprintf_s(buf, "Allocations per frame: %.2f heap, %.2f COM\n",
+                (double)reportHeapAllocs / STATS_REPORT_FRAMES,
+                (double)reportComAllocs / STATS_REPORT_FRAMES);
+            OutputDebugStringA(buf);
+            sprintf_s(buf, "Frame time with %d windows: %.3f ms\n",
+                NUM_OUTPUT_WINDOWS,
+                1000.0 * reportFrameTicks / qpcFrequency.QuadPart / STATS_REPORT_FRAMES);
+            OutputDebugStringA(buf);
+            for (int i = 0; i < NUM_OUTPUT_WINDOWS; i++)
+            {
+                ReportPresentMonitor(&outputs[i].presentMonitor, i, qpcFrequency.QuadPart);
+            }
+            ReportInputLatency(&g_inputLatency);
+            double reportWindowArea = (double)SCREEN_WIDTH * SCREEN_HEIGHT * NUM_OUTPUT_WINDOWS * STATS_REPORT_FRAMES;
+            sprintf_s(buf, "Dirty area: %.1f%% of the windows, %.1f%% repainted\n",
+                100.0 * reportDirtyArea / reportWindowArea,
+                100.0 * reportRepaintArea / reportWindowArea);
+            OutputDebugStringA(buf);
+            sprintf_s(buf, "Occlusion: %u frames skipped, %u output frames skipped, %u test presents, %.0f ms slept\n",
+                occlusionStats.skippedFrames,
+                occlusionStats.skippedOutputFrames,
+                occlusionStats.testPresents,
+                occlusionStats.sleptMs);
+            OutputDebugStringA(buf);
+            occlusionStats = {};
+            sprintf_s(buf, "GL state calls per frame: %.2f issued, %.2f filtered\n",
+                (double)g_glState.issued / STATS_REPORT_FRAMES,
+                (double)g_glState.filtered / STATS_REPORT_FRAMES);
+            OutputDebugStringA(buf);
+            g_glState.issued = 0;
+            g_glState.filtered = 0;
+            sprintf_s(buf, "D3D state calls per frame: %.2f issued, %.2f filtered (state objects: %d cached, %u hits, %u created, %u uncached)\n",
+                (double)d3dState.issued / STATS_REPORT_FRAMES,
+                (double)d3dState.filtered / STATS_REPORT_FRAMES,
+                g_stateObjects.count,
+                g_stateObjects.hits,
+                g_stateObjects.misses,
+                g_stateObjects.uncached);
+            OutputDebugStringA(buf);
+            d3dState.issued = 0;
+            d3dState.filtered = 0;
+            sprintf_s(buf, "Frame arena: peak %u of %u bytes, %u overflows, %u fence waits\n",
+                (unsigned)g_frameArena.peak,
+                (unsigned)FRAME_ARENA_SIZE,
+                g_frameArena.overflows,
+                g_frameArena.fenceWaits);
+            OutputDebugStringA(buf);
+            g_frameArena.peak = 0;
+            g_frameArena.overflows = 0;
+            g_frameArena.fenceWaits = 0;
+#ifdef TEXTURE_STREAMING
+            sprintf_s(buf, "Texture streaming: %.1f MB/s, %u uploads, %u stalls, %.3f ms per upload written\n",
+                g_textureStreamer.bytesUploaded / (1024.0 * 1024.0) / ((double)reportFrameTicks / qpcFrequency.QuadPart),
+                g_textureStreamer.uploads,
+                g_textureStreamer.stalls,
+                g_textureStreamer.uploads ? 1000.0 * g_textureStreamer.fillTicks / qpcFrequency.QuadPart / g_textureStreamer.uploads : 0.0);
+            OutputDebugStringA(buf);
+            g_textureStreamer.bytesUploaded = 0;
+            g_textureStreamer.uploads = 0;
+            g_textureStreamer.stalls = 0;
+            g_textureStreamer.fillTicks = 0;
+#endif
+#ifdef COMPUTE_INTEROP
+            sprintf_s(buf, "Compute interop: %.1f dispatches per frame\n", (double)g_particles.dispatches / STATS_REPORT_FRAMES);
+            OutputDebugStringA(buf);
+            g_particles.dispatches = 0;
+#endif
+            if (frameJobs)
+            {
+                size_t peakFrameMemory = 0;
+                for (int t = 0; t < frameJobs->threadCount; t++)
+                {
+                    FrameAllocator& allocator = frameJobs->allocators[t];
+                    peakFrameMemory = allocator.peak > peakFrameMemory ? allocator.peak : peakFrameMemory;
+                    allocator.peak = 0;
+                }
+                sprintf_s(buf, "Jobs per frame: %.1f run, %.1f stolen, on %d threads (peak frame memory %u bytes per thread)\n",
+                    (double)frameJobs->jobsRun / STATS_REPORT_FRAMES,
+                    (double)frameJobs->steals / STATS_REPORT_FRAMES,
+                    frameJobs->threadCount,
+                    (unsigned)peakFrameMemory);
+                OutputDebugStringA(buf);
+                frameJobs->jobsRun = 0;
+                frameJobs->steals = 0;
+            }
+#ifdef BENCHMARK_SCENE
+            double reportSeconds = (double)reportFrameTicks / qpcFrequency.QuadPart;
+            sprintf_s(buf, "Benchmark: %.0f draw calls/s, %.3f us per D3D/GL switch (%d objects, %d%% D3D, %d switches)\n",
+                g_benchmarkScene.drawCalls / reportSeconds,
+                g_benchmarkScene.apiSwitches ? 1000000.0 * g_benchmarkScene.apiSwitchTicks / qpcFrequency.QuadPart / g_benchmarkScene.apiSwitches : 0.0,
+                BENCHMARK_OBJECT_COUNT,
+                (int)(BENCHMARK_D3D_FRACTION * 100.0 + 0.5),
+                BENCHMARK_API_SWITCHES);
+            OutputDebugStringA(buf);
+            sprintf_s(buf, "Benchmark CPU stages: %.3f ms per frame\n", 1000.0 * g_benchmarkScene.cpuStageTicks / qpcFrequency.QuadPart / STATS_REPORT_FRAMES);
+            OutputDebugStringA(buf);
+            g_benchmarkScene.drawCalls = 0;
+            g_benchmarkScene.apiSwitches = 0;
+            g_benchmarkScene.apiSwitchTicks = 0;
+            g_benchmarkScene.cpuStageTicks = 0;
+            for (int w = 0; w < g_recordWorkers.count; w++)
+            {
+                RecordWorker& worker = g_recordWorkers.workers[w];
+                sprintf_s(buf, "Record worker %d: %.3f ms per frame\n", w, 1000.0 * worker.recordTicks / qpcFrequency.QuadPart / STATS_REPORT_FRAMES);
+                OutputDebugStringA(buf);
+                worker.recordTicks = 0;
+            }
+            if (g_benchmarkScene.useBatchGL)
+            {
+                BatchRendererGL& batch = g_benchmarkScene.batchGL;
+                sprintf_s(buf, "GL batch: %.0f draws/ms built, %.2f multi-draw calls per frame, %u fence waits\n",
+                    batch.buildTicks ? batch.builtDraws / (1000.0 * batch.buildTicks / qpcFrequency.QuadPart) : 0.0,
+                    (double)batch.multiDrawCalls / STATS_REPORT_FRAMES,
+                    batch.fenceWaits);
+                OutputDebugStringA(buf);
+                batch.builtDraws = 0;
+                batch.buildTicks = 0;
+                batch.fenceWaits = 0;
+                batch.multiDrawCalls = 0;
+            }
+#endif
+            g_stateObjects.hits = 0;
+            g_stateObjects.misses = 0;
+            g_stateObjects.uncached = 0;
+            if (PRESENT_MODE == PRESENT_MODE_CAPPED && frameLimiter.waits > 0)
+            {
+                sprintf_s(buf, "Frame limiter error: %.3f ms average, %.3f ms max\n",
+                    1000.0 * frameLimiter.totalLateTicks / frameLimiter.qpcFrequency / frameLimiter.waits,
+                    1000.0 * frameLimiter.maxLateTicks / frameLimiter.qpcFrequency);
+                OutputDebugStringA(buf);
+                frameLimiter.totalLateTicks = 0;
+                frameLimiter.maxLateTicks = 0;
+                frameLimiter.waits = 0;
+            }
+            if (PRESENT_MODE == PRESENT_MODE_PACED)
+            {
+                ReportFramePacer(&framePacer, STATS_REPORT_FRAMES);
+            }
+            reportHeapAllocs = 0;
+            reportComAllocs = 0;
+            reportFrameTicks = 0;
+            reportDirtyArea = 0.0;
+            reportRepaintArea = 0.0;
+        }
     }
 }
\ No newline at end of file